@@ -0,0 +1,908 @@
+/**
+ * @file batch.c
+ * @author Xavier Monard
+ * @brief Batch engine, steps BATCH_LANES copies of a machine in lockstep. Lanes at the
+ * same PC form a group whose instruction is decoded once and executed on every lane of
+ * the group, with AVX2 masked operations when the compiler targets it (make AVX2=1).
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "include/batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* Loop over the lanes selected by a mask. */
+#define FOR_LANES(l, mask) for (uint8_t l = 0; l < BATCH_LANES; l++) if (mask[l])
+
+#ifdef __AVX2__
+/* Unsigned a > b on every byte, the maximum of a and b is not b. */
+static __m256i greater(__m256i a, __m256i b){
+    return _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b), _mm256_set1_epi8(-1));
+}
+#endif
+
+/**
+ * @brief Copy src in dst on the lanes of the mask.
+ *
+ * @param dst Row to update.
+ * @param src New values.
+ * @param mask LANE_ON on the lanes to update.
+ */
+static void blend(uint8_t* dst, const uint8_t* src, const uint8_t* mask){
+#ifdef __AVX2__
+    for (uint32_t c = 0; c < BATCH_STRIDE; c += BATCH_VECTOR){
+        __m256i old = _mm256_loadu_si256((const __m256i*) (dst + c));
+        __m256i new = _mm256_loadu_si256((const __m256i*) (src + c));
+        __m256i m = _mm256_loadu_si256((const __m256i*) (mask + c));
+        _mm256_storeu_si256((__m256i*) (dst + c), _mm256_blendv_epi8(old, new, m));
+    }
+#else
+    for (uint32_t l = 0; l < BATCH_STRIDE; l++){
+        dst[l] = (dst[l] & ~mask[l]) | (src[l] & mask[l]);
+    }
+#endif
+}
+
+/**
+ * @brief Result of the 8xy operation on every lane. 0 is a copy of b, which also serves 6xkk.
+ *
+ * @param out Results.
+ * @param a Values of Vx.
+ * @param b Values of Vy (or kk).
+ * @param op Last nibble of the opcode : 0, 1, 2, 3, 4, 5, 6, 7 or E.
+ */
+static void alu(uint8_t* out, const uint8_t* a, const uint8_t* b, uint8_t op){
+#ifdef __AVX2__
+    for (uint32_t c = 0; c < BATCH_STRIDE; c += BATCH_VECTOR){
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + c));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + c));
+        __m256i r;
+        switch (op){
+            case 0x0: r = vb; break;
+            case 0x1: r = _mm256_or_si256(va, vb); break;
+            case 0x2: r = _mm256_and_si256(va, vb); break;
+            case 0x3: r = _mm256_xor_si256(va, vb); break;
+            case 0x4: r = _mm256_add_epi8(va, vb); break;
+            case 0x5: r = _mm256_sub_epi8(va, vb); break;
+            case 0x6: r = _mm256_and_si256(_mm256_srli_epi16(va, 1), _mm256_set1_epi8(0x7F)); break;
+            case 0x7: r = _mm256_sub_epi8(vb, va); break;
+            default: r = _mm256_add_epi8(va, va); break; // 0xE
+        }
+        _mm256_storeu_si256((__m256i*) (out + c), r);
+    }
+#else
+    for (uint32_t l = 0; l < BATCH_STRIDE; l++){
+        switch (op){
+            case 0x0: out[l] = b[l]; break;
+            case 0x1: out[l] = a[l] | b[l]; break;
+            case 0x2: out[l] = a[l] & b[l]; break;
+            case 0x3: out[l] = a[l] ^ b[l]; break;
+            case 0x4: out[l] = a[l] + b[l]; break;
+            case 0x5: out[l] = a[l] - b[l]; break;
+            case 0x6: out[l] = a[l] >> 1; break;
+            case 0x7: out[l] = b[l] - a[l]; break;
+            default: out[l] = a[l] << 1; break; // 0xE
+        }
+    }
+#endif
+}
+
+/**
+ * @brief VF set by the 8xy operation on every lane, 0 or 1.
+ *
+ * @param out Flags.
+ * @param a Values of Vx.
+ * @param b Values of Vy.
+ * @param op Last nibble of the opcode : 4, 5, 6, 7 or E.
+ */
+static void flag(uint8_t* out, const uint8_t* a, const uint8_t* b, uint8_t op){
+#ifdef __AVX2__
+    __m256i one = _mm256_set1_epi8(1);
+    for (uint32_t c = 0; c < BATCH_STRIDE; c += BATCH_VECTOR){
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + c));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + c));
+        __m256i r;
+        switch (op){
+            case 0x4: r = greater(va, _mm256_xor_si256(vb, _mm256_set1_epi8(-1))); break; // Carry, a > 255 - b
+            case 0x5: r = greater(va, vb); break;
+            case 0x6: r = va; break;
+            case 0x7: r = greater(vb, va); break;
+            default: r = _mm256_srli_epi16(va, 7); break; // 0xE
+        }
+        _mm256_storeu_si256((__m256i*) (out + c), _mm256_and_si256(r, one));
+    }
+#else
+    for (uint32_t l = 0; l < BATCH_STRIDE; l++){
+        switch (op){
+            case 0x4: out[l] = a[l] + b[l] > 0xFF; break;
+            case 0x5: out[l] = a[l] > b[l]; break;
+            case 0x6: out[l] = a[l] & 0x1; break;
+            case 0x7: out[l] = b[l] > a[l]; break;
+            default: out[l] = a[l] >> 7; break; // 0xE
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Compare two rows, LANE_ON where they are equal (or different).
+ *
+ * @param out Result of the comparison.
+ * @param a First row.
+ * @param b Second row.
+ * @param different 1 to select the different lanes.
+ */
+static void compare(uint8_t* out, const uint8_t* a, const uint8_t* b, uint8_t different){
+#ifdef __AVX2__
+    __m256i invert = _mm256_set1_epi8(different ? -1 : 0);
+    for (uint32_t c = 0; c < BATCH_STRIDE; c += BATCH_VECTOR){
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + c));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + c));
+        _mm256_storeu_si256((__m256i*) (out + c), _mm256_xor_si256(_mm256_cmpeq_epi8(va, vb), invert));
+    }
+#else
+    for (uint32_t l = 0; l < BATCH_STRIDE; l++){
+        out[l] = ((a[l] == b[l]) ^ different) ? LANE_ON : LANE_OFF;
+    }
+#endif
+}
+
+/**
+ * @brief Set a 16 bits row to a value on the lanes of the mask.
+ *
+ * @param dst Row to update (I or PC).
+ * @param value New value.
+ * @param mask LANE_ON on the lanes to update.
+ */
+static void set_words(uint16_t* dst, uint16_t value, const uint8_t* mask){
+#ifdef __AVX2__
+    __m256i v = _mm256_set1_epi16(value);
+    for (uint32_t c = 0; c < BATCH_STRIDE; c += BATCH_VECTOR / 2){
+        // LANE_ON is sign extended to 0xFFFF
+        __m256i m = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (mask + c)));
+        __m256i old = _mm256_loadu_si256((const __m256i*) (dst + c));
+        _mm256_storeu_si256((__m256i*) (dst + c), _mm256_blendv_epi8(old, v, m));
+    }
+#else
+    for (uint32_t l = 0; l < BATCH_STRIDE; l++){
+        dst[l] = mask[l] ? value : dst[l];
+    }
+#endif
+}
+
+/**
+ * @brief Add a value to a 16 bits row on the lanes of the mask.
+ *
+ * @param dst Row to update (I or PC).
+ * @param value Value to add.
+ * @param mask LANE_ON on the lanes to update.
+ */
+static void add_words(uint16_t* dst, uint16_t value, const uint8_t* mask){
+#ifdef __AVX2__
+    __m256i v = _mm256_set1_epi16(value);
+    for (uint32_t c = 0; c < BATCH_STRIDE; c += BATCH_VECTOR / 2){
+        __m256i m = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (mask + c)));
+        __m256i old = _mm256_loadu_si256((const __m256i*) (dst + c));
+        _mm256_storeu_si256((__m256i*) (dst + c), _mm256_add_epi16(old, _mm256_and_si256(v, m)));
+    }
+#else
+    for (uint32_t l = 0; l < BATCH_STRIDE; l++){
+        dst[l] += mask[l] ? value : 0;
+    }
+#endif
+}
+
+/* Opcode at the PC of a lane. */
+static uint16_t fetch(batch* b, uint8_t lane){
+    uint16_t pc = b->PC[lane];
+    return (b->machines[lane].ram[pc] << 8) + b->machines[lane].ram[(uint16_t) (pc+1)];
+}
+
+/**
+ * @brief Form the next group : the pending lanes with the lowest PC whose opcode is the
+ * one of the first of them. Lanes at the same PC may still differ by self modifying code.
+ *
+ * @param b The batch.
+ * @param pending Lanes which did not execute their instruction yet.
+ * @param group LANE_ON on the lanes of the group.
+ * @param opcode The opcode of the group.
+ * @return uint8_t 0 if no lane is pending.
+ */
+static uint8_t next_group(batch* b, const uint8_t* pending, uint8_t* group, uint16_t* opcode){
+#ifdef __AVX2__
+    // Lowest PC of the pending lanes, the others count as 0xFFFF
+    __m256i lowest = _mm256_set1_epi16(-1);
+    uint32_t any = 0;
+    for (uint32_t c = 0; c < BATCH_STRIDE; c += BATCH_VECTOR / 2){
+        __m256i m = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (pending + c)));
+        __m256i pc = _mm256_loadu_si256((const __m256i*) (b->PC + c));
+        lowest = _mm256_min_epu16(lowest, _mm256_or_si256(pc, _mm256_xor_si256(m, _mm256_set1_epi16(-1))));
+        any |= _mm256_movemask_epi8(m);
+    }
+    if (any == 0){
+        return 0;
+    }
+    __m128i halves = _mm_min_epu16(_mm256_castsi256_si128(lowest), _mm256_extracti128_si256(lowest, 1));
+    uint16_t pc_group = _mm_extract_epi16(_mm_minpos_epu16(halves), 0);
+    __m256i target = _mm256_set1_epi16(pc_group);
+
+    int leader = -1;
+    for (uint32_t c = 0; c < BATCH_STRIDE; c += BATCH_VECTOR){
+        __m256i low = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*) (b->PC + c)), target);
+        __m256i high = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*) (b->PC + c + 16)), target);
+        // Packing works per 128 bits half, the permutation puts the lanes back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+        packed = _mm256_and_si256(packed, _mm256_loadu_si256((const __m256i*) (pending + c)));
+        _mm256_storeu_si256((__m256i*) (group + c), packed);
+        uint32_t bits = _mm256_movemask_epi8(packed);
+        if (leader < 0 && bits != 0){
+            leader = c + __builtin_ctz(bits);
+        }
+    }
+    *opcode = fetch(b, leader);
+
+    // The gather would read the second byte of PC 0xFFFF past the memory of the lane, fetch() wraps to ram[0]
+    if (pc_group == 0xFFFF){
+        for (uint32_t l = 0; l < BATCH_LANES; l++){
+            group[l] = group[l] && fetch(b, l) == *opcode ? LANE_ON : LANE_OFF;
+        }
+        return 1;
+    }
+
+    // Gather the opcodes of the group, 8 lanes at a time, the bytes are swapped in the 32 bits words.
+    // The 4 bytes read at PC 0xFFFE end in the registers of the machine, which follow its memory.
+    __m256i expected = _mm256_set1_epi32((*opcode >> 8) | ((*opcode & 0xFF) << 8));
+    __m256i words = _mm256_set1_epi32(0xFFFF);
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (uint32_t c = 0; c < BATCH_STRIDE; c += BATCH_VECTOR){
+        __m256i same[4];
+        for (uint32_t q = 0; q < 4; q++){
+            uint32_t first = c + 8 * q;
+            __m256i m = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*) (group + first)));
+            __m256i pc = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) (b->PC + first)));
+            __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(lanes, _mm256_set1_epi32(first)), _mm256_set1_epi32(sizeof(cpu))), pc);
+            __m256i code = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*) b->machines[0].ram, index, m, 1);
+            same[q] = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(code, words), expected), m);
+        }
+        __m256i packed = _mm256_packs_epi16(_mm256_packs_epi32(same[0], same[1]), _mm256_packs_epi32(same[2], same[3]));
+        packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        _mm256_storeu_si256((__m256i*) (group + c), packed);
+    }
+#else
+    uint32_t lowest = MEMORY_SIZE;
+    uint8_t leader = 0;
+    for (uint8_t l = 0; l < BATCH_LANES; l++){
+        uint32_t pc = pending[l] ? b->PC[l] : MEMORY_SIZE;
+        if (pc < lowest){
+            lowest = pc;
+            leader = l;
+        }
+    }
+    if (lowest == MEMORY_SIZE){
+        return 0;
+    }
+    *opcode = fetch(b, leader);
+    for (uint32_t l = 0; l < BATCH_STRIDE; l++){
+        group[l] = b->PC[l] == lowest && pending[l] && fetch(b, l) == *opcode ? LANE_ON : LANE_OFF;
+    }
+#endif
+    return 1;
+}
+
+/* Skip the next instruction of the lanes, the XO-CHIP F000 nnnn instruction is 4 bytes long. */
+static void skip_next(batch* b, const uint8_t* mask){
+    FOR_LANES(l, mask){
+        uint16_t next = b->PC[l] + 2;
+        if (b->machines[l].ram[next] == 0xF0 && b->machines[l].ram[(uint16_t) (next+1)] == 0x00){
+            b->PC[l] += 4;
+        }
+        else {
+            b->PC[l] += 2;
+        }
+    }
+}
+
+/**
+ * @brief Execute the same opcode on every lane of a group, as interpret_opcode() does on one machine.
+ * Fx0A does not wait : a lane without pressed key executes it again at the next step.
+ *
+ * @param b The batch.
+ * @param opcode The opcode shared by the group.
+ * @param mask LANE_ON on the lanes of the group.
+ */
+static void execute(batch* b, uint16_t opcode, const uint8_t* mask){
+    uint8_t hexa[4];
+    uint8_t row[BATCH_STRIDE];
+    uint8_t cond[BATCH_STRIDE];
+    uint16_t nnn = opcode & 0xFFF;
+    uint8_t kk = opcode & 0xFF;
+
+    hexa[0] = opcode >> 12;
+    hexa[1] = (opcode >> 8) & 0xF;
+    hexa[2] = (opcode >> 4) & 0xF;
+    hexa[3] = opcode & 0xF;
+
+    switch (hexa[0]){
+        case 0x00: // 00E0, 00EE, 00Cn, 00Dn, 00FB, 00FC, 00FD, 00FE and 00FF
+            FOR_LANES(l, mask){
+                if (hexa[2] == 0xE && hexa[3] == 0x0){
+                    clear_framebuffer(&b->machines[l].screen);
+                }
+                else if (hexa[2] == 0xE && hexa[3] == 0xE){
+                    if (b->stack_pointer[l] > 0){
+                        b->stack_pointer[l]--;
+                        b->PC[l] = b->stack[b->stack_pointer[l]][l];
+                    }
+                }
+                else if (hexa[1] == 0x0 && hexa[2] == 0xC){
+                    scroll_down(&b->machines[l].screen, hexa[3]);
+                }
+                else if (hexa[1] == 0x0 && hexa[2] == 0xD){
+                    scroll_up(&b->machines[l].screen, hexa[3]);
+                    b->machines[l].xochip = 1;
+                }
+                else if (hexa[1] == 0x0 && hexa[2] == 0xF){
+                    switch (hexa[3]){
+                        case 0xB: scroll_right(&b->machines[l].screen); break;
+                        case 0xC: scroll_left(&b->machines[l].screen); break;
+                        case 0xD: b->active[l] = LANE_OFF; break;
+                        case 0xE: set_resolution(&b->machines[l].screen, 0); break;
+                        case 0xF: set_resolution(&b->machines[l].screen, 1); break;
+                        default: break;
+                    }
+                }
+            }
+            break;
+
+        case 0x01: // 1nnn
+            set_words(b->PC, nnn - 2, mask);
+            break;
+
+        case 0x02: // 2nnn
+            FOR_LANES(l, mask){
+                b->stack[b->stack_pointer[l]][l] = b->PC[l];
+                if (b->stack_pointer[l] < 15){
+                    b->stack_pointer[l]++;
+                }
+                b->PC[l] = nnn - 2;
+            }
+            break;
+
+        case 0x03: // 3xkk
+        case 0x04: // 4xkk
+            memset(cond, kk, sizeof(cond));
+            compare(row, b->V[hexa[1]], cond, hexa[0] == 0x04);
+            memset(cond, LANE_OFF, sizeof(cond));
+            blend(cond, row, mask);
+            skip_next(b, cond);
+            break;
+
+        case 0x05: // 5xy0, 5xy2 and 5xy3
+            if (hexa[3] == 0x2){
+                FOR_LANES(l, mask){
+                    for (uint8_t k = 0; k <= abs(hexa[2] - hexa[1]); k++){
+                        b->machines[l].ram[(uint16_t) (b->I[l] + k)] = b->V[hexa[1] < hexa[2] ? hexa[1] + k : hexa[1] - k][l];
+                    }
+                    b->machines[l].xochip = 1;
+                }
+            }
+            else if (hexa[3] == 0x3){
+                FOR_LANES(l, mask){
+                    for (uint8_t k = 0; k <= abs(hexa[2] - hexa[1]); k++){
+                        b->V[hexa[1] < hexa[2] ? hexa[1] + k : hexa[1] - k][l] = b->machines[l].ram[(uint16_t) (b->I[l] + k)];
+                    }
+                    b->machines[l].xochip = 1;
+                }
+            }
+            else {
+                compare(row, b->V[hexa[1]], b->V[hexa[2]], 0);
+                memset(cond, LANE_OFF, sizeof(cond));
+                blend(cond, row, mask);
+                skip_next(b, cond);
+            }
+            break;
+
+        case 0x06: // 6xkk
+        case 0x07: // 7xkk
+            memset(row, kk, sizeof(row));
+            alu(row, b->V[hexa[1]], row, hexa[0] == 0x06 ? 0x0 : 0x4);
+            blend(b->V[hexa[1]], row, mask);
+            break;
+
+        case 0x08: // 8xy0, 8xy1, 8xy2, 8xy3, 8xy4, 8xy5, 8xy6, 8xy7 and 8xyE
+            if (hexa[3] > 0x7 && hexa[3] != 0xE){
+                break;
+            }
+            // VF is written before Vx, as the scalar core does when x or y is F
+            if (hexa[3] >= 0x4){
+                flag(row, b->V[hexa[1]], b->V[hexa[2]], hexa[3]);
+                blend(b->V[0xF], row, mask);
+            }
+            alu(row, b->V[hexa[1]], b->V[hexa[2]], hexa[3]);
+            blend(b->V[hexa[1]], row, mask);
+            break;
+
+        case 0x09: // 9xy0
+            compare(row, b->V[hexa[1]], b->V[hexa[2]], 1);
+            memset(cond, LANE_OFF, sizeof(cond));
+            blend(cond, row, mask);
+            skip_next(b, cond);
+            break;
+
+        case 0x0A: // Annn
+            set_words(b->I, nnn, mask);
+            break;
+
+        case 0x0B: // Bnnn
+            FOR_LANES(l, mask){
+                b->PC[l] = nnn + b->V[0][l] - 2;
+            }
+            break;
+
+        case 0x0C: // Cxkk
+            FOR_LANES(l, mask){
+                b->V[hexa[1]][l] = random_byte(&b->rng[l]) % (kk + 1);
+            }
+            break;
+
+        case 0x0D: // Dxyn and Dxy0
+            FOR_LANES(l, mask){
+                uint8_t height = hexa[3] == 0 ? 16 : hexa[3];
+                uint8_t planes = (b->machines[l].screen.planes & 1) + (b->machines[l].screen.planes >> 1 & 1);
+                uint8_t buffer[PLANES * 32];
+                uint8_t* sprite = wrap_memory(b->machines[l].ram, b->I[l], (hexa[3] == 0 ? 32 : height) * planes, buffer);
+                b->V[0xF][l] = blit_sprite(&b->machines[l].screen, sprite, b->V[hexa[1]][l], b->V[hexa[2]][l], height, hexa[3] == 0);
+            }
+            break;
+
+        case 0x0E: // Ex9E and ExA1
+            if ((hexa[2] == 0x9 && hexa[3] == 0xE) || (hexa[2] == 0xA && hexa[3] == 0x1)){
+                uint8_t expected = hexa[2] == 0x9 ? KEY_PRESSED : KEY_UNPRESSED;
+                memset(cond, LANE_OFF, sizeof(cond));
+                FOR_LANES(l, mask){
+                    cond[l] = b->keyboard[b->V[hexa[1]][l] & 0xF][l] == expected ? LANE_ON : LANE_OFF;
+                }
+                skip_next(b, cond);
+            }
+            break;
+
+        case 0x0F:
+            switch (hexa[2]){
+                case 0x0: // F000, Fn01, F002, Fx07 and Fx0A
+                    if (hexa[1] == 0x0 && hexa[3] == 0x0){
+                        FOR_LANES(l, mask){
+                            b->I[l] = (b->machines[l].ram[(uint16_t) (b->PC[l]+2)]<<8) + b->machines[l].ram[(uint16_t) (b->PC[l]+3)];
+                            b->PC[l] += 2;
+                            b->machines[l].xochip = 1;
+                        }
+                    }
+                    else if (hexa[3] == 0x1){
+                        FOR_LANES(l, mask){
+                            select_planes(&b->machines[l].screen, hexa[1]);
+                            b->machines[l].xochip = 1;
+                        }
+                    }
+                    else if (hexa[1] == 0x0 && hexa[3] == 0x2){
+                        FOR_LANES(l, mask){
+                            for (uint8_t k = 0; k < AUDIO_PATTERN_SIZE; k++){
+                                b->machines[l].pattern[k] = b->machines[l].ram[(uint16_t) (b->I[l] + k)];
+                            }
+                            b->pattern_loaded[l] = 1;
+                            b->machines[l].xochip = 1;
+                        }
+                    }
+                    else if (hexa[3] == 0x7){
+                        blend(b->V[hexa[1]], b->delay, mask);
+                    }
+                    else if (hexa[3] == 0xA){
+                        // The lane waits here until batch_key() presses a key
+                        FOR_LANES(l, mask){
+                            b->waiting[l] = 1;
+                            b->wait_register[l] = hexa[1];
+                            b->PC[l] -= 2;
+                        }
+                    }
+                    break;
+
+                case 0x1: // Fx15, Fx18 and Fx1E
+                    if (hexa[3] == 0x5){
+                        blend(b->delay, b->V[hexa[1]], mask);
+                    }
+                    else if (hexa[3] == 0x8){
+                        blend(b->sound_timer, b->V[hexa[1]], mask);
+                    }
+                    else if (hexa[3] == 0xE){
+                        FOR_LANES(l, mask){
+                            if (b->machines[l].xochip){
+                                b->I[l] += b->V[hexa[1]][l];
+                            }
+                            else if (b->I[l] + b->V[hexa[1]][l] > 0xFFF){
+                                b->V[0xF][l] = 1;
+                            }
+                            else {
+                                b->V[0xF][l] = 0;
+                                b->I[l] += b->V[hexa[1]][l];
+                            }
+                        }
+                    }
+                    break;
+
+                case 0x2: // Fx29
+                    FOR_LANES(l, mask){
+                        b->I[l] = 5*b->V[hexa[1]][l];
+                    }
+                    break;
+
+                case 0x3: // Fx30, Fx33 and Fx3A
+                    FOR_LANES(l, mask){
+                        uint8_t v = b->V[hexa[1]][l];
+                        uint16_t i = b->I[l];
+                        if (hexa[3] == 0x0){
+                            b->I[l] = BIG_DIGIT_AREA + BIG_HEX_REP_SIZE * (v & 0xF);
+                        }
+                        else if (hexa[3] == 0xA){
+                            b->pitch[l] = v;
+                            b->machines[l].xochip = 1;
+                        }
+                        else {
+                            // Same digits as the scalar core
+                            b->machines[l].ram[i] = (v - b->V[hexa[1]%100][l])/100;
+                            b->machines[l].ram[(uint16_t) (i+1)] = ((v-v%10)/10)%10;
+                            b->machines[l].ram[(uint16_t) (i+2)] = v - b->machines[l].ram[i]*100 - b->machines[l].ram[(uint16_t) (i+1)]*10;
+                        }
+                    }
+                    break;
+
+                case 0x5: // Fx55
+                    FOR_LANES(l, mask){
+                        for (uint8_t k = 0x0; k <= hexa[1]; k++){
+                            b->machines[l].ram[(uint16_t) (b->I[l] + k)] = b->V[k][l];
+                        }
+                    }
+                    break;
+
+                case 0x6: // Fx65
+                    FOR_LANES(l, mask){
+                        for (uint8_t k = 0x0; k <= hexa[1]; k++){
+                            b->V[k][l] = b->machines[l].ram[(uint16_t) (b->I[l] + k)];
+                        }
+                    }
+                    break;
+
+                case 0x7: // Fx75
+                    for (uint8_t k = 0x0; k <= hexa[1]; k++){
+                        blend(b->rpl[k], b->V[k], mask);
+                    }
+                    break;
+
+                case 0x8: // Fx85
+                    for (uint8_t k = 0x0; k <= hexa[1]; k++){
+                        blend(b->V[k], b->rpl[k], mask);
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+    }
+    add_words(b->PC, 2, mask);
+}
+
+/**
+ * @brief Allocate a batch whose every lane is a copy of a machine.
+ *
+ * @param machine The machine to copy, its ROM already loaded.
+ * @return batch* The batch, to free with batch_destroy().
+ */
+batch* batch_create(cpu* machine){
+    batch* b = calloc(1, sizeof(batch));
+    if (b == NULL){
+        fprintf(stderr, "Unable to allocate the batch.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint8_t l = 0; l < BATCH_LANES; l++){
+        batch_load(b, l, machine);
+    }
+    b->split_frames = BATCH_SPLIT_STEPS / CPU_SPEED;
+    return b;
+}
+
+/**
+ * @brief Free a batch.
+ *
+ * @param b The batch.
+ */
+void batch_destroy(batch* b){
+    free(b);
+}
+
+/* Copy the registers of a machine of the batch in the rows of its lane. */
+static void machine_to_lane(batch* b, uint8_t lane){
+    cpu* machine = &b->machines[lane];
+
+    for (uint8_t k = 0; k < REGISTER_NUMBER; k++){
+        b->V[k][lane] = machine->V[k];
+    }
+    for (uint8_t k = 0; k < STACK_SIZE; k++){
+        b->stack[k][lane] = machine->stack[k];
+    }
+    for (uint8_t k = 0; k < NB_KEYS; k++){
+        b->keyboard[k][lane] = machine->keyboard[k];
+    }
+    for (uint8_t k = 0; k < RPL_FLAGS; k++){
+        b->rpl[k][lane] = machine->rpl[k];
+    }
+    b->I[lane] = machine->I;
+    b->PC[lane] = machine->PC;
+    b->delay[lane] = machine->delay;
+    b->sound_timer[lane] = machine->sound_timer;
+    b->stack_pointer[lane] = machine->stack_pointer;
+    b->pitch[lane] = machine->pitch;
+    b->pattern_loaded[lane] = machine->pattern_loaded;
+    b->rng[lane] = machine->rng;
+    b->waiting[lane] = machine->waiting;
+    b->wait_register[lane] = machine->wait_register;
+}
+
+/* Copy the rows of a lane in the registers of its machine. */
+static void lane_to_machine(batch* b, uint8_t lane){
+    cpu* machine = &b->machines[lane];
+
+    for (uint8_t k = 0; k < REGISTER_NUMBER; k++){
+        machine->V[k] = b->V[k][lane];
+    }
+    for (uint8_t k = 0; k < STACK_SIZE; k++){
+        machine->stack[k] = b->stack[k][lane];
+    }
+    for (uint8_t k = 0; k < NB_KEYS; k++){
+        machine->keyboard[k] = b->keyboard[k][lane];
+    }
+    for (uint8_t k = 0; k < RPL_FLAGS; k++){
+        machine->rpl[k] = b->rpl[k][lane];
+    }
+    machine->I = b->I[lane];
+    machine->PC = b->PC[lane];
+    machine->delay = b->delay[lane];
+    machine->sound_timer = b->sound_timer[lane];
+    machine->stack_pointer = b->stack_pointer[lane];
+    machine->pitch = b->pitch[lane];
+    machine->pattern_loaded = b->pattern_loaded[lane];
+    machine->rng = b->rng[lane];
+    machine->waiting = b->waiting[lane];
+    machine->wait_register = b->wait_register[lane];
+}
+
+/**
+ * @brief Copy a machine in a lane, the lane becomes active.
+ *
+ * @param b The batch.
+ * @param lane The lane to overwrite.
+ * @param machine The machine to copy.
+ */
+void batch_load(batch* b, uint8_t lane, cpu* machine){
+    b->machines[lane] = *machine;
+    if (b->split == 0){
+        machine_to_lane(b, lane);
+    }
+    b->active[lane] = LANE_ON;
+}
+
+/**
+ * @brief Copy a lane back in a machine, to run it with the scalar core or display it.
+ *
+ * @param b The batch.
+ * @param lane The lane to copy.
+ * @param machine The machine to overwrite.
+ */
+void batch_store(batch* b, uint8_t lane, cpu* machine){
+    if (b->split == 0){
+        lane_to_machine(b, lane);
+    }
+    *machine = b->machines[lane];
+}
+
+/**
+ * @brief Execute one instruction on every active lane, each machine in turn with the scalar core.
+ * Forming the groups costs more than it saves once the lanes diverged.
+ *
+ * @param b The batch.
+ * @return uint32_t Number of lanes executed.
+ */
+static uint32_t step_machines(batch* b){
+    cpu* previous = cpu_context;
+    uint32_t executed = 0;
+
+    for (uint8_t l = 0; l < BATCH_LANES; l++){
+        if (b->active[l] == LANE_ON){
+            cpu_context = &b->machines[l];
+            if (step() == 0){
+                b->active[l] = LANE_OFF;
+            }
+            executed++;
+        }
+    }
+    cpu_context = previous;
+    return executed;
+}
+
+/**
+ * @brief Execute one instruction on every active lane. The pending lanes with the lowest PC
+ * and the same opcode form a group, so diverged lanes run apart and merge again when their PC meet.
+ * When a step needs more than BATCH_SPLIT_GROUPS groups, the registers go to the machines and the next
+ * BATCH_SPLIT_STEPS steps run each machine with the scalar core, then the lanes are grouped again in case
+ * they converged.
+ *
+ * @param b The batch.
+ * @return uint32_t Number of groups executed, a lane run alone counts as a group, 0 once every lane stopped.
+ */
+uint32_t batch_step(batch* b){
+    uint8_t pending[BATCH_STRIDE];
+    uint8_t group[BATCH_STRIDE];
+    uint32_t groups = 0;
+
+    uint16_t opcode;
+
+    if (b->split > 0){
+        groups = step_machines(b);
+        if (--b->split == 0){
+            for (uint8_t l = 0; l < BATCH_LANES; l++){
+                machine_to_lane(b, l);
+            }
+        }
+        return groups;
+    }
+    memcpy(pending, b->active, sizeof(pending));
+    while (next_group(b, pending, group, &opcode)){
+        execute(b, opcode, group);
+        for (uint32_t l = 0; l < BATCH_STRIDE; l++){
+            pending[l] &= ~group[l];
+        }
+        groups++;
+    }
+    if (groups > BATCH_SPLIT_GROUPS){
+        for (uint8_t l = 0; l < BATCH_LANES; l++){
+            lane_to_machine(b, l);
+        }
+        b->split = BATCH_SPLIT_STEPS;
+    }
+    return groups;
+}
+
+/**
+ * @brief Run each machine alone for a block of frames with the scalar core, then group the lanes again.
+ * A machine runs the whole block in a row : interleaved with the others one instruction at a time,
+ * the branch predictor loses its history and the core runs 3 times slower.
+ *
+ * @param b The batch, split.
+ * @param frames Frames of the block.
+ * @return uint64_t Number of machine steps executed.
+ */
+static uint64_t run_machines(batch* b, uint32_t frames){
+    cpu* previous = cpu_context;
+    uint64_t executed = 0;
+
+    for (uint8_t l = 0; l < BATCH_LANES; l++){
+        uint8_t keep_up = b->active[l] == LANE_ON;
+
+        cpu_context = &b->machines[l];
+        for (uint32_t frame = 0; frame < frames && keep_up; frame++){
+            for (int actions = 0; actions < CPU_SPEED && keep_up; actions++){
+                keep_up = step();
+                executed++;
+            }
+            time_count();
+        }
+        if (keep_up == 0){
+            b->active[l] = LANE_OFF;
+        }
+        machine_to_lane(b, l);
+    }
+    cpu_context = previous;
+    b->split = 0;
+    return executed;
+}
+
+/**
+ * @brief Run frames of CPU_SPEED steps followed by a timer decount, as run_frame() does on one machine.
+ * The lanes run grouped while they share their PC, once they diverge each machine runs alone for a block
+ * of frames, then the lanes are grouped again for one frame. The block starts at BATCH_SPLIT_STEPS steps and
+ * doubles up to BATCH_SPLIT_MAX_FRAMES frames while the lanes stay diverged.
+ *
+ * @param b The batch.
+ * @param frames Number of frames.
+ * @return uint64_t Number of machine steps executed, 0 once every lane stopped.
+ */
+uint64_t batch_run(batch* b, uint32_t frames){
+    uint64_t executed = 0;
+    uint8_t after_block = 0;
+
+    while (frames > 0){
+        if (b->split > 0){
+            uint32_t block = frames < b->split_frames ? frames : b->split_frames;
+            executed += run_machines(b, block);
+            frames -= block;
+            after_block = 1;
+            continue;
+        }
+        for (int actions = 0; actions < CPU_SPEED; actions++){
+            for (uint8_t l = 0; l < BATCH_LANES; l++){
+                executed += b->active[l] == LANE_ON;
+            }
+            batch_step(b);
+        }
+        batch_time_count(b);
+        frames--;
+        // Still diverged right after a block : the next block is twice as long
+        if (b->split == 0){
+            b->split_frames = BATCH_SPLIT_STEPS / CPU_SPEED;
+        }
+        else if (after_block && b->split_frames < BATCH_SPLIT_MAX_FRAMES){
+            b->split_frames *= 2;
+        }
+        after_block = 0;
+    }
+    return executed;
+}
+
+/**
+ * @brief Press or release a key of a lane, as set_key() does : a press ends the wait of Fx0A.
+ *
+ * @param b The batch.
+ * @param lane The lane.
+ * @param key The key, 0 to F.
+ * @param state KEY_PRESSED or KEY_UNPRESSED.
+ */
+void batch_key(batch* b, uint8_t lane, uint8_t key, uint8_t state){
+    if (b->split > 0){
+        cpu* previous = cpu_context;
+        cpu_context = &b->machines[lane];
+        set_key(key, state);
+        cpu_context = previous;
+        return;
+    }
+    b->keyboard[key][lane] = state;
+    if (state == KEY_PRESSED && b->waiting[lane] == 1){
+        b->V[b->wait_register[lane]][lane] = key;
+        b->waiting[lane] = 0;
+        b->PC[lane] += 2;
+    }
+}
+
+/**
+ * @brief Decount the delay and sound timers of every lane, as time_count() does.
+ *
+ * @param b The batch.
+ */
+void batch_time_count(batch* b){
+    if (b->split > 0){
+        cpu* previous = cpu_context;
+        for (uint8_t l = 0; l < BATCH_LANES; l++){
+            cpu_context = &b->machines[l];
+            time_count();
+        }
+        cpu_context = previous;
+        return;
+    }
+#ifdef __AVX2__
+    __m256i one = _mm256_set1_epi8(1);
+    for (uint32_t c = 0; c < BATCH_STRIDE; c += BATCH_VECTOR){
+        __m256i delay = _mm256_loadu_si256((const __m256i*) (b->delay + c));
+        __m256i sound = _mm256_loadu_si256((const __m256i*) (b->sound_timer + c));
+        _mm256_storeu_si256((__m256i*) (b->delay + c), _mm256_subs_epu8(delay, one));
+        _mm256_storeu_si256((__m256i*) (b->sound_timer + c), _mm256_subs_epu8(sound, one));
+    }
+#else
+    for (uint32_t l = 0; l < BATCH_STRIDE; l++){
+        b->delay[l] -= b->delay[l] > 0;
+        b->sound_timer[l] -= b->sound_timer[l] > 0;
+    }
+#endif
+}
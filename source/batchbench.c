@@ -0,0 +1,88 @@
+/**
+ * @file batchbench.c
+ * @author Xavier Monard
+ * @brief Throughput of the batch engine against the scalar core, in machine steps per second.
+ * Every lane gets its own random seed, so the lanes diverge as soon as the game uses Cxkk.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/cpu.h"
+#include "include/batch.h"
+
+#define BENCH_STEPS 1000000
+
+/* Seconds elapsed since start. */
+double elapsed(Uint64 start){
+    return (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+int main(int argc, char* argv[]){
+    long steps = BENCH_STEPS;
+    static cpu start;
+    static cpu scalar[BATCH_LANES];
+    static cpu lane;
+
+    if (argc < 2){
+        printf("You must give a rom.\n");
+        printf("Usage : %s <rom> [<steps>]\n", argv[0]);
+        return 1;
+    }
+    if (argc >= 3){
+        steps = strtol(argv[2], NULL, 10);
+    }
+    // Whole frames, the batch decounts the timers after each one
+    steps -= steps % CPU_SPEED;
+    initialize();
+    load_game(argv[1]);
+    start = CPU;
+
+    // Scalar core, one machine after the other
+    Uint64 timer = SDL_GetPerformanceCounter();
+    uint64_t scalar_steps = 0;
+    for (uint8_t l = 0; l < BATCH_LANES; l++){
+        CPU = start;
+        CPU.rng = RNG_SEED + l;
+        for (long k = 0; k < steps; k++){
+            scalar_steps++;
+            if (step() == 0){
+                break;
+            }
+            if (k % CPU_SPEED == CPU_SPEED - 1){
+                time_count();
+            }
+        }
+        scalar[l] = CPU;
+    }
+    double scalar_time = elapsed(timer);
+
+    // Batch engine, every lane at once
+    batch* b = batch_create(&start);
+    for (uint8_t l = 0; l < BATCH_LANES; l++){
+        b->rng[l] = RNG_SEED + l;
+    }
+    timer = SDL_GetPerformanceCounter();
+    uint64_t batch_steps = batch_run(b, steps / CPU_SPEED);
+    double batch_time = elapsed(timer);
+
+    // Both engines must end in the same state
+    uint8_t matching = 0;
+    for (uint8_t l = 0; l < BATCH_LANES; l++){
+        batch_store(b, l, &lane);
+        matching += memcmp(lane.V, scalar[l].V, REGISTER_NUMBER) == 0 && lane.I == scalar[l].I
+                 && lane.PC == scalar[l].PC && memcmp(&lane.screen, &scalar[l].screen, sizeof(framebuffer)) == 0;
+    }
+    batch_destroy(b);
+
+    printf("%d lanes, %ld steps\n", BATCH_LANES, steps);
+    printf("scalar : %8.2f M machine steps/s\n", scalar_steps / scalar_time / 1e6);
+    printf("batch  : %8.2f M machine steps/s\n", batch_steps / batch_time / 1e6);
+    printf("speedup: %8.2f\n", (batch_steps / batch_time) / (scalar_steps / scalar_time));
+    printf("lanes matching the scalar core : %u/%u\n", matching, BATCH_LANES);
+    return matching == BATCH_LANES ? 0 : 1;
+}
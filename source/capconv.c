@@ -0,0 +1,192 @@
+/**
+ * @file capconv.c
+ * @author Xavier Monard
+ * @brief Converter of capture files to a sequence of PBM or PNG images, one per captured frame.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/capture.h"
+
+static uint32_t crc_table[256];
+
+/* Fill the CRC-32 table of the PNG chunks. */
+static void make_crc_table(){
+    for (uint32_t n = 0; n < 256; n++){
+        uint32_t c = n;
+        for (uint8_t k = 0; k < 8; k++){
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, uint32_t size){
+    crc = ~crc;
+    for (uint32_t k = 0; k < size; k++){
+        crc = crc_table[(crc ^ data[k]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/* Write a 32 bits big endian integer. */
+static void put32(uint8_t* out, uint32_t value){
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+/* Write a PNG chunk : length, type, data and CRC of type and data. */
+static void write_chunk(FILE* file, const char* type, const uint8_t* data, uint32_t size){
+    uint8_t word[4];
+    uint32_t crc = crc32(0, (const uint8_t*) type, 4);
+
+    crc = crc32(crc, data, size);
+    put32(word, size);
+    fwrite(word, 4, 1, file);
+    fwrite(type, 4, 1, file);
+    fwrite(data, size, 1, file);
+    put32(word, crc);
+    fwrite(word, 4, 1, file);
+}
+
+/**
+ * @brief Write a framebuffer as a 1 bit grayscale PNG, a pixel being white when it is lit in a plane.
+ * The image data is stored in uncompressed deflate blocks, the frames being tiny.
+ *
+ * @param file The image file, opened in binary mode.
+ * @param fb The framebuffer.
+ */
+static void write_png(FILE* file, framebuffer* fb){
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    uint8_t width = fb->hires ? SCREEN_WIDTH : LORES_WIDTH;
+    uint8_t height = fb->hires ? SCREEN_HEIGTH : LORES_HEIGTH;
+    uint8_t header[13] = {0};
+    uint8_t raw[SCREEN_HEIGTH * (1 + SCREEN_WIDTH / 8)];
+    uint8_t zlib[2 + sizeof(raw) + 5 + 4];
+    uint32_t size = 0, length = 0;
+
+    for (uint8_t y = 0; y < height; y++){
+        raw[size++] = 0; // No filter
+        for (uint8_t x = 0; x < width; x += 8){
+            raw[size++] = (fb->rows[0][y][x >> 6] | fb->rows[1][y][x >> 6]) >> (56 - (x & 63));
+        }
+    }
+
+    put32(header, width);
+    put32(header + 4, height);
+    header[8] = 1; // Bit depth
+    header[9] = 0; // Grayscale
+
+    // zlib stream : header, one stored block, Adler-32 of the data
+    uint32_t a = 1, b = 0;
+    zlib[length++] = 0x78;
+    zlib[length++] = 0x01;
+    zlib[length++] = 1; // Last block, stored
+    zlib[length++] = size & 0xFF;
+    zlib[length++] = size >> 8;
+    zlib[length++] = ~size & 0xFF;
+    zlib[length++] = (~size >> 8) & 0xFF;
+    for (uint32_t k = 0; k < size; k++){
+        a = (a + raw[k]) % 65521;
+        b = (b + a) % 65521;
+        zlib[length++] = raw[k];
+    }
+    put32(zlib + length, (b << 16) | a);
+    length += 4;
+
+    fwrite(signature, sizeof(signature), 1, file);
+    write_chunk(file, "IHDR", header, sizeof(header));
+    write_chunk(file, "IDAT", zlib, length);
+    write_chunk(file, "IEND", NULL, 0);
+}
+
+int main(int argc, char* argv[]){
+    char* capture_path = NULL;
+    char* prefix = NULL;
+    uint8_t png = 0;
+    unsigned long first = 0, last = 0xFFFFFFFF;
+
+    for (int k = 1; k < argc; k++){
+        if (strcmp(argv[k], "--png") == 0){
+            png = 1;
+        }
+        else if (strcmp(argv[k], "--first") == 0 && k + 1 < argc){
+            first = strtoul(argv[++k], NULL, 10);
+        }
+        else if (strcmp(argv[k], "--last") == 0 && k + 1 < argc){
+            last = strtoul(argv[++k], NULL, 10);
+        }
+        else if (capture_path == NULL){
+            capture_path = argv[k];
+        }
+        else {
+            prefix = argv[k];
+        }
+    }
+    if (capture_path == NULL || prefix == NULL){
+        printf("Usage : %s [--png] [--first <frame>] [--last <frame>] <capture> <output prefix>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE* capture = fopen(capture_path, "rb");
+    char magic[4];
+    uint16_t header[2];
+    if (capture == NULL || fread(magic, 4, 1, capture) != 1 || memcmp(magic, CAPTURE_MAGIC, 4) != 0
+        || fread(header, sizeof(header), 1, capture) != 1 || header[0] != CAPTURE_VERSION || header[1] != sizeof(capture_header)){
+        fprintf(stderr, "%s is not a capture file.\n", capture_path);
+        return EXIT_FAILURE;
+    }
+    make_crc_table();
+
+    static uint8_t bitmap[CAPTURE_BITMAP_SIZE];
+    static uint8_t delta[CAPTURE_BITMAP_SIZE];
+    static uint8_t encoded[CAPTURE_MAX_ENCODED];
+    capture_header frame;
+    uint32_t images = 0, frames = 0;
+    uint32_t first_time = 0, last_time = 0;
+    while (fread(&frame, sizeof(frame), 1, capture) == 1){
+        uint32_t size = (frame.hires ? SCREEN_WIDTH * SCREEN_HEIGTH : LORES_WIDTH * LORES_HEIGTH) * PLANES / 8;
+        if (frame.size > sizeof(encoded) || fread(encoded, frame.size, 1, capture) != (frame.size > 0)
+            || capture_decode(encoded, frame.size, delta, size) != size){
+            fprintf(stderr, "Truncated capture after frame %u.\n", frame.frame);
+            break;
+        }
+        for (uint32_t k = 0; k < size; k++){
+            bitmap[k] = frame.kind == CAPTURE_DELTA ? bitmap[k] ^ delta[k] : delta[k];
+        }
+        first_time = frames == 0 ? frame.time : first_time;
+        last_time = frame.time;
+        frames++;
+        if (frame.frame < first || frame.frame > last){
+            continue;
+        }
+
+        char name[FILENAME_MAX];
+        framebuffer fb;
+        snprintf(name, sizeof(name), "%s-%06u.%s", prefix, frame.frame, png ? "png" : "pbm");
+        FILE* image = fopen(name, "wb");
+        if (image == NULL){
+            fprintf(stderr, "Unable to write %s.\n", name);
+            return EXIT_FAILURE;
+        }
+        capture_framebuffer(bitmap, frame.hires, &fb);
+        if (png){
+            write_png(image, &fb);
+        }
+        else {
+            write_pbm(image, &fb);
+        }
+        fclose(image);
+        images++;
+    }
+    fclose(capture);
+    printf("%u frames over %.2fs, %u images written\n", frames, (last_time - first_time) / 1e6, images);
+    return EXIT_SUCCESS;
+}
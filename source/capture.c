@@ -0,0 +1,245 @@
+/**
+ * @file capture.c
+ * @author Xavier Monard
+ * @brief Gameplay capture and screenshots. The emulator thread copies the packed framebuffer in a
+ * ring of slots and returns, a writer thread codes the frames and writes them, so the capture
+ * never waits for the disk. When the writer lags behind, frames are dropped and counted.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include "include/capture.h"
+
+/**
+ * @brief A frame waiting for the writer.
+ *
+ * @param rows The planes of the framebuffer.
+ * @param hires 1 in the 128x64 mode.
+ * @param frame Number of the emulated frame.
+ * @param time Time of the frame since the start of the capture, in us.
+ * @param screenshot 1 to write the frame as a PBM image instead of recording it.
+ */
+typedef struct {
+    uint64_t rows[PLANES][SCREEN_HEIGTH][ROW_WORDS];
+    uint8_t hires;
+    uint32_t frame;
+    uint32_t time;
+    uint8_t screenshot;
+} capture_slot;
+
+static capture_slot slots[CAPTURE_SLOTS];
+static SDL_atomic_t published;
+static SDL_atomic_t written;
+static SDL_atomic_t running;
+static SDL_sem* work = NULL;
+static SDL_Thread* writer = NULL;
+static FILE* capture_file = NULL;
+static Uint64 start = 0;
+static uint8_t recording = 0;
+static uint32_t dropped = 0;
+static uint64_t queued = 0;
+static Uint64 queue_time = 0;
+
+/* The writer state : the previous bitmap, to code the next frame as a delta. */
+static uint8_t previous[CAPTURE_BITMAP_SIZE];
+static uint8_t previous_hires = 0xFF;
+static uint32_t since_key = 0;
+
+/* Code a frame and append it to the capture file. */
+static void write_frame(capture_slot* slot){
+    static uint8_t bitmap[CAPTURE_BITMAP_SIZE];
+    static uint8_t encoded[CAPTURE_MAX_ENCODED];
+    framebuffer fb;
+    capture_header header;
+
+    memcpy(fb.rows, slot->rows, sizeof(fb.rows));
+    fb.hires = slot->hires;
+    uint32_t size = capture_bitmap(&fb, bitmap);
+
+    header.frame = slot->frame;
+    header.time = slot->time;
+    header.hires = slot->hires;
+    header.kind = CAPTURE_DELTA;
+    if (slot->hires != previous_hires || since_key >= CAPTURE_KEY_INTERVAL){
+        header.kind = CAPTURE_KEY;
+        since_key = 0;
+    }
+    since_key++;
+    previous_hires = slot->hires;
+
+    if (header.kind == CAPTURE_DELTA){
+        for (uint32_t k = 0; k < size; k++){
+            uint8_t pixels = bitmap[k];
+            bitmap[k] ^= previous[k];
+            previous[k] = pixels;
+        }
+    }
+    else {
+        memcpy(previous, bitmap, size);
+    }
+    header.size = capture_encode(bitmap, size, encoded);
+    fwrite(&header, sizeof(header), 1, capture_file);
+    fwrite(encoded, header.size, 1, capture_file);
+}
+
+/* Write a screenshot as screenshot-<frame>.pbm in the working directory. */
+static void write_screenshot(capture_slot* slot){
+    char name[64];
+    framebuffer fb;
+    FILE* file;
+
+    memset(&fb, 0, sizeof(fb));
+    memcpy(fb.rows, slot->rows, sizeof(fb.rows));
+    fb.hires = slot->hires;
+    snprintf(name, sizeof(name), "screenshot-%u.pbm", slot->frame);
+    file = fopen(name, "wb");
+    if (file == NULL){
+        fprintf(stderr, "Unable to write %s.\n", name);
+        return;
+    }
+    write_pbm(file, &fb);
+    fclose(file);
+    printf("Screenshot written in %s\n", name);
+}
+
+/* Write every published slot. */
+static void flush_slots(){
+    unsigned done = (unsigned) SDL_AtomicGet(&written);
+    while (done != (unsigned) SDL_AtomicGet(&published)){
+        capture_slot* slot = &slots[done % CAPTURE_SLOTS];
+        SDL_MemoryBarrierAcquire();
+        if (slot->screenshot){
+            write_screenshot(slot);
+        }
+        else if (capture_file != NULL){
+            write_frame(slot);
+        }
+        done++;
+        SDL_AtomicSet(&written, (int) done);
+    }
+}
+
+/* Writer thread, writes the frames as soon as they are published. */
+static int writer_main(void* data){
+    (void) data;
+    while (SDL_AtomicGet(&running)){
+        SDL_SemWaitTimeout(work, 100);
+        flush_slots();
+        // A capture stays readable up to its last written frame if the emulator is killed
+        if (capture_file != NULL){
+            fflush(capture_file);
+        }
+    }
+    flush_slots();
+    return 0;
+}
+
+/* Start the writer thread on first use. */
+static void start_writer(){
+    if (writer == NULL){
+        start = SDL_GetPerformanceCounter();
+        work = SDL_CreateSemaphore(0);
+        SDL_AtomicSet(&running, 1);
+        writer = SDL_CreateThread(writer_main, "capture writer", NULL);
+    }
+}
+
+/**
+ * @brief Copy a framebuffer in a free slot for the writer, or drop it when none is free.
+ *
+ * @param fb The framebuffer.
+ * @param frame Number of the frame.
+ * @param screenshot 1 for a screenshot.
+ */
+static void queue_frame(framebuffer* fb, uint64_t frame, uint8_t screenshot){
+    Uint64 now = SDL_GetPerformanceCounter();
+    unsigned next = (unsigned) SDL_AtomicGet(&published);
+
+    if (next - (unsigned) SDL_AtomicGet(&written) >= CAPTURE_SLOTS){
+        dropped++;
+        return;
+    }
+    capture_slot* slot = &slots[next % CAPTURE_SLOTS];
+    memcpy(slot->rows, fb->rows, sizeof(slot->rows));
+    slot->hires = fb->hires;
+    slot->frame = frame;
+    slot->time = (now - start) * 1000000 / SDL_GetPerformanceFrequency();
+    slot->screenshot = screenshot;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&published, (int) (next + 1));
+    SDL_SemPost(work);
+
+    queued++;
+    queue_time += SDL_GetPerformanceCounter() - now;
+}
+
+/**
+ * @brief Start recording the frames in a capture file.
+ *
+ * @param capture_path Path of the capture file to create.
+ * @return uint8_t 1 on success, 0 otherwise.
+ */
+uint8_t capture_open(char* capture_path){
+    uint16_t header[2] = {CAPTURE_VERSION, sizeof(capture_header)};
+
+    capture_file = fopen(capture_path, "wb");
+    if (capture_file == NULL){
+        fprintf(stderr, "Unable to create the capture file %s\n", capture_path);
+        return 0;
+    }
+    fwrite(CAPTURE_MAGIC, 4, 1, capture_file);
+    fwrite(header, sizeof(header), 1, capture_file);
+    start_writer();
+    recording = 1;
+    return 1;
+}
+
+/**
+ * @brief Record a frame, if a capture was opened.
+ *
+ * @param fb The framebuffer of the frame.
+ * @param frame Number of the frame.
+ */
+void capture_frame(framebuffer* fb, uint64_t frame){
+    if (recording){
+        queue_frame(fb, frame, 0);
+    }
+}
+
+/**
+ * @brief Write a framebuffer as a PBM image, from the writer thread.
+ *
+ * @param fb The framebuffer.
+ * @param frame Number of the frame, in the name of the image.
+ */
+void capture_screenshot(framebuffer* fb, uint64_t frame){
+    start_writer();
+    queue_frame(fb, frame, 1);
+}
+
+/**
+ * @brief Write the queued frames, stop the writer and close the capture file.
+ *
+ */
+void capture_close(){
+    if (writer == NULL){
+        return;
+    }
+    SDL_AtomicSet(&running, 0);
+    SDL_SemPost(work);
+    SDL_WaitThread(writer, NULL);
+    SDL_DestroySemaphore(work);
+    writer = NULL;
+
+    if (capture_file != NULL){
+        fclose(capture_file);
+        capture_file = NULL;
+        printf("Capture : %lu frames, %u dropped, %.2f us per frame on the emulator thread\n", (unsigned long) queued, dropped,
+               queued ? (double) queue_time * 1000000 / SDL_GetPerformanceFrequency() / queued : 0.0);
+    }
+    recording = 0;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file capture_codec.c
+ * @author Xavier Monard
+ * @brief Packing of framebuffers in 1 bit per pixel bitmaps and run-length coding of the bitmaps,
+ * shared by the capture writer and the capture converter.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <string.h>
+#include "include/capture.h"
+
+/**
+ * @brief Pack the visible rows of both planes, 8 pixels per byte.
+ *
+ * @param fb The framebuffer.
+ * @param bitmap At least CAPTURE_BITMAP_SIZE bytes.
+ * @return uint32_t Size of the bitmap.
+ */
+uint32_t capture_bitmap(framebuffer* fb, uint8_t* bitmap){
+    uint8_t bytes = (fb->hires ? SCREEN_WIDTH : LORES_WIDTH) / 8;
+    uint8_t rows = fb->hires ? SCREEN_HEIGTH : LORES_HEIGTH;
+    uint32_t size = 0;
+
+    for (uint8_t p = 0; p < PLANES; p++){
+        for (uint8_t y = 0; y < rows; y++){
+            for (uint8_t b = 0; b < bytes; b++){
+                bitmap[size++] = fb->rows[p][y][b >> 3] >> (56 - 8 * (b & 7));
+            }
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief Unpack a bitmap made by capture_bitmap().
+ *
+ * @param bitmap The bitmap.
+ * @param hires 1 for a 128x64 bitmap.
+ * @param fb Receives the planes, the other fields are reset.
+ */
+void capture_framebuffer(uint8_t* bitmap, uint8_t hires, framebuffer* fb){
+    uint8_t bytes = (hires ? SCREEN_WIDTH : LORES_WIDTH) / 8;
+    uint8_t rows = hires ? SCREEN_HEIGTH : LORES_HEIGTH;
+
+    memset(fb, 0, sizeof(framebuffer));
+    fb->hires = hires;
+    for (uint8_t p = 0; p < PLANES; p++){
+        for (uint8_t y = 0; y < rows; y++){
+            for (uint8_t b = 0; b < bytes; b++){
+                fb->rows[p][y][b >> 3] |= (uint64_t) *bitmap++ << (56 - 8 * (b & 7));
+            }
+        }
+    }
+}
+
+/**
+ * @brief Code a bitmap as literal and zero run tokens. Bitmaps are mostly zeros, deltas even more.
+ *
+ * @param bitmap The bitmap.
+ * @param size Its size.
+ * @param out At least CAPTURE_MAX_ENCODED bytes.
+ * @return uint32_t Size of the coded bitmap.
+ */
+uint32_t capture_encode(uint8_t* bitmap, uint32_t size, uint8_t* out){
+    uint32_t length = 0;
+    uint32_t k = 0;
+
+    while (k < size){
+        uint32_t run = 0;
+        while (k + run < size && bitmap[k + run] == 0 && run < 128){
+            run++;
+        }
+        if (run > 0){
+            out[length++] = CAPTURE_ZEROS + run - 1;
+            k += run;
+            continue;
+        }
+        // Literal bytes up to the next pair of zero bytes
+        uint32_t literal = 0;
+        while (k + literal < size && literal < 128
+               && !(bitmap[k + literal] == 0 && k + literal + 1 < size && bitmap[k + literal + 1] == 0)){
+            literal++;
+        }
+        out[length++] = CAPTURE_LITERAL + literal - 1;
+        memcpy(out + length, bitmap + k, literal);
+        length += literal;
+        k += literal;
+    }
+    return length;
+}
+
+/**
+ * @brief Decode a bitmap coded by capture_encode().
+ *
+ * @param data The tokens.
+ * @param size Their size.
+ * @param bitmap Receives the bitmap.
+ * @param bitmap_size Size of the bitmap.
+ * @return uint32_t Number of bytes decoded, bitmap_size if the data is valid.
+ */
+uint32_t capture_decode(uint8_t* data, uint32_t size, uint8_t* bitmap, uint32_t bitmap_size){
+    uint32_t length = 0;
+    uint32_t k = 0;
+
+    while (k < size){
+        uint8_t token = data[k++];
+        uint32_t count = (token & 0x7F) + 1;
+        if (length + count > bitmap_size){
+            break;
+        }
+        if (token >= CAPTURE_ZEROS){
+            memset(bitmap + length, 0, count);
+        }
+        else {
+            if (k + count > size){
+                break;
+            }
+            memcpy(bitmap + length, data + k, count);
+            k += count;
+        }
+        length += count;
+    }
+    return length;
+}
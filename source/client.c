@@ -0,0 +1,118 @@
+/**
+ * @file client.c
+ * @author Xavier Monard
+ * @brief Window of a session of the multi-session host : sends the keys, applies the received rows.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "include/host.h"
+
+/* Chip-8 key of a SDL key, -1 for the other keys. */
+int chip8_key(SDL_Keycode sym){
+    static const char keys[] = "0123456789abcdef";
+    char* key = sym > 0 && sym < 128 ? strchr(keys, (char) sym) : NULL;
+    return key == NULL ? -1 : key - keys;
+}
+
+/**
+ * @brief Read the messages of the host and apply them to the screen, the socket does not block.
+ *
+ * @param server The connection to the host.
+ * @param screen The screen of the session.
+ * @return uint8_t 0 if the host closed the session.
+ */
+uint8_t receive(int server, framebuffer* screen){
+    static uint8_t message[MAX_DELTA_SIZE];
+    static uint32_t size = 0;
+    ssize_t n;
+
+    while ((n = read(server, message + size, sizeof(message) - size)) > 0){
+        size += n;
+        // Apply every complete message
+        for (;;){
+            frame_delta header;
+            if (size < sizeof(header)){
+                break;
+            }
+            memcpy(&header, message, sizeof(header));
+            uint32_t length = sizeof(header) + header.rows * sizeof(row_delta);
+            if (size < length){
+                break;
+            }
+            if (header.hires != screen->hires){
+                set_resolution(screen, header.hires);
+            }
+            for (uint16_t k = 0; k < header.rows; k++){
+                row_delta row;
+                memcpy(&row, message + sizeof(header) + k * sizeof(row), sizeof(row));
+                memcpy(screen->rows[row.plane % PLANES][row.y % SCREEN_HEIGTH], row.words, sizeof(row.words));
+            }
+            memmove(message, message + length, size - length);
+            size -= length;
+        }
+    }
+    return n != 0 && (n > 0 || errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int main(int argc, char* argv[]){
+    struct sockaddr_un address;
+    framebuffer screen;
+    char* socket_path = argc >= 2 ? argv[1] : HOST_SOCKET;
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    if (server < 0 || connect(server, (struct sockaddr*) &address, sizeof(address)) < 0){
+        fprintf(stderr, "Unable to connect to %s\n", socket_path);
+        return EXIT_FAILURE;
+    }
+    fcntl(server, F_SETFL, fcntl(server, F_GETFL) | O_NONBLOCK);
+    if (SDL_Init(SDL_INIT_VIDEO) == -1){
+        fprintf(stderr, "Unable to launch SDL :\n %s", SDL_GetError());
+        return EXIT_FAILURE;
+    }
+    initialize_sdl();
+    memset(&screen, 0, sizeof(screen));
+    select_planes(&screen, 1);
+
+    uint8_t keep_up = 1;
+    while (keep_up){
+        while (SDL_PollEvent(&sdl_event)){
+            if (sdl_event.type == SDL_QUIT){
+                keep_up = 0;
+            }
+            else if ((sdl_event.type == SDL_KEYDOWN && sdl_event.key.repeat == 0) || sdl_event.type == SDL_KEYUP){
+                int key = chip8_key(sdl_event.key.keysym.sym);
+                key_event event = {key, sdl_event.type == SDL_KEYDOWN};
+                if (key >= 0 && write(server, &event, sizeof(event)) != sizeof(event)){
+                    keep_up = 0;
+                }
+            }
+        }
+        if (receive(server, &screen) == 0){
+            keep_up = 0;
+        }
+        render_framebuffer(&screen);
+        SDL_Delay(FPS);
+    }
+
+    close(server);
+    SDL_DestroyTexture(sdl_texture);
+    SDL_DestroyRenderer(sdl_renderer);
+    SDL_DestroyWindow(sdl_window);
+    SDL_Quit();
+    return EXIT_SUCCESS;
+}
@@ -10,31 +10,66 @@
  */
 #include "include/cpu.h"
 #include "include/display.h"
-
-cpu CPU;
+#include "include/trace.h"
+#include <string.h>
+
+static cpu machine;
+THREAD_LOCAL cpu* cpu_context = &machine;
+
+/* CHIP-8 4x5 digits (Fx29), the content of DIGIT_PATH unless load_digit() replaced them. */
+static uint8_t digit[16 * HEX_REP_SIZE] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+/* SUPER-CHIP 8x10 digits, stored after the small ones (Fx30). */
+static const uint8_t big_digit[16 * BIG_HEX_REP_SIZE] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
 
 /**
- * @brief Initialize the CPU used by the emulator. It sets registers, the stack and keyboard state to 0.
+ * @brief Reset the machine of the thread. Memory, registers, stack, keyboard and screen are cleared, padding
+ * included, then the fonts are loaded. The screen is back in low resolution, the audio pattern is unloaded,
+ * the buzzer plays its default tone and the random generator is reseeded.
  * 
  */
 void initialize(){
-    for (uint8_t k = 0; k < REGISTER_NUMBER; k++){
-        CPU.V[k] = 0;
-    }
-    
-    for (uint8_t j = 0; j < STACK_SIZE; j++){
-        CPU.stack[j] = 0;
-    }
-    load_digit(DIGIT_PATH);
-    CPU.I = 0;
+    memset(&CPU, 0, sizeof(CPU));
+    initialize_screen();
+    memcpy(&CPU.ram[0], digit, sizeof(digit));
+    memcpy(&CPU.ram[BIG_DIGIT_AREA], big_digit, sizeof(big_digit));
     CPU.PC = READ_AREA;
-    
-    CPU.delay = 0;
-    CPU.sound_timer = 0;
-
-    for (uint8_t k = 0; k < NB_KEYS; k++){
-        CPU.keyboard[k] = 0;
-    }
+    CPU.pitch = DEFAULT_PITCH;
+    CPU.rng = RNG_SEED;
 }
 
 /**
@@ -56,7 +91,21 @@ void time_count(){
  * @return uint16_t A 2 bytes opcode
  */
 uint16_t get_opcode(){
-    return (CPU.ram[CPU.PC]<<8) + (CPU.ram[CPU.PC+1]);
+    return (CPU.ram[CPU.PC]<<8) + (CPU.ram[(uint16_t) (CPU.PC+1)]);
+}
+
+/**
+ * @brief Skip the next instruction, the XO-CHIP F000 nnnn instruction is 4 bytes long.
+ * 
+ */
+static void skip_next(){
+    uint16_t next = CPU.PC + 2;
+    if (CPU.ram[next] == 0xF0 && CPU.ram[(uint16_t) (next+1)] == 0x00){
+        CPU.PC+=4;
+    }
+    else {
+        CPU.PC+=2;
+    }
 }
 
 /**
@@ -66,16 +115,16 @@ uint16_t get_opcode(){
  */
 uint8_t interpret_opcode(uint16_t opcode){
     uint8_t hexa[4];    
-    uint16_t mask[4] = {0xF000, 0x0F00, 0x00F0, 0x000F};
     uint8_t keep_up = 1;
 
-    for (uint8_t k = 0; k < 4; k++){
-        hexa[k] = (opcode & mask[k]) >> (12 - 4 * k); 
-    }
+    hexa[0] = opcode >> 12;
+    hexa[1] = (opcode >> 8) & 0xF;
+    hexa[2] = (opcode >> 4) & 0xF;
+    hexa[3] = opcode & 0xF;
 
     /* Interpret leftmost 4 bits and developp if needed */
     switch (hexa[0]){
-        case 0x00: // 0NNN and 00E0 and 00EE
+        case 0x00: // 0NNN, 00E0, 00EE, 00Cn, 00Dn, 00FB, 00FC, 00FD, 00FE and 00FF
             if (hexa[2] == 0xE && hexa[3] == 0x0){ // 00E0
                 // Clear the display.
                 clear_screen();                
@@ -86,6 +135,49 @@ uint8_t interpret_opcode(uint16_t opcode){
                     CPU.stack_pointer--; 
                     CPU.PC = CPU.stack[CPU.stack_pointer];
                 }
+                else {
+                    CPU.fault |= FAULT_STACK_UNDERFLOW;
+                }
+            }
+            else if (hexa[1] == 0x0 && hexa[2] == 0xC){ // 00Cn
+                // Scroll display n lines down.
+                scroll_down(&CPU.screen, hexa[3]);
+            }
+            else if (hexa[1] == 0x0 && hexa[2] == 0xD){ // 00Dn
+                // Scroll display n lines up.
+                scroll_up(&CPU.screen, hexa[3]);
+                CPU.xochip = 1;
+            }
+            else if (hexa[1] == 0x0 && hexa[2] == 0xF){
+                switch (hexa[3]){
+                    case 0xB: // 00FB
+                        // Scroll display 4 pixels right.
+                        scroll_right(&CPU.screen);
+                        break;
+
+                    case 0xC: // 00FC
+                        // Scroll display 4 pixels left.
+                        scroll_left(&CPU.screen);
+                        break;
+
+                    case 0xD: // 00FD
+                        // Exit the interpreter.
+                        keep_up = 0;
+                        break;
+
+                    case 0xE: // 00FE
+                        // Disable high resolution mode.
+                        set_resolution(&CPU.screen, 0);
+                        break;
+
+                    case 0xF: // 00FF
+                        // Enable high resolution mode.
+                        set_resolution(&CPU.screen, 1);
+                        break;
+
+                    default:
+                        break;
+                }
             } // ONNN (Nothing to do...)
             break;
 
@@ -101,6 +193,9 @@ uint8_t interpret_opcode(uint16_t opcode){
             if (CPU.stack_pointer < 15 ){
                 CPU.stack_pointer++;
             }
+            else {
+                CPU.fault |= FAULT_STACK_OVERFLOW;
+            }
             
             CPU.PC = (hexa[1]<<8) + (hexa[2]<<4) + hexa[3];
             CPU.PC-=2;
@@ -109,21 +204,39 @@ uint8_t interpret_opcode(uint16_t opcode){
         case 0x03: // 3xkk
             // Skip next instruction if Vx = kk.
             if (CPU.V[hexa[1]] == (hexa[2]<<4) + hexa[3]){
-                CPU.PC+=2;
+                skip_next();
             }
             break;
 
         case 0x04: // 4xkk
             // Skip next instruction if Vx != kk.
             if (CPU.V[hexa[1]] != (hexa[2]<<4) + hexa[3]){
-                CPU.PC+=2;
+                skip_next();
             }
             break;
 
-        case 0x05: // 5xy0
+        case 0x05: // 5xy0, 5xy2 and 5xy3
+            if (hexa[3] == 0x2 || hexa[3] == 0x3){
+                CPU.xochip = 1;
+                if (CPU.I + abs(hexa[2] - hexa[1]) >= MEMORY_SIZE){
+                    CPU.fault |= FAULT_MEMORY;
+                }
+            }
+            if (hexa[3] == 0x2){ // 5xy2
+                // Store registers Vx through Vy in memory starting at location I, I is unchanged.
+                for (uint8_t k = 0; k <= abs(hexa[2] - hexa[1]); k++){
+                    CPU.ram[(uint16_t) (CPU.I + k)] = CPU.V[hexa[1] < hexa[2] ? hexa[1] + k : hexa[1] - k];
+                }
+            }
+            else if (hexa[3] == 0x3){ // 5xy3
+                // Read registers Vx through Vy from memory starting at location I, I is unchanged.
+                for (uint8_t k = 0; k <= abs(hexa[2] - hexa[1]); k++){
+                    CPU.V[hexa[1] < hexa[2] ? hexa[1] + k : hexa[1] - k] = CPU.ram[(uint16_t) (CPU.I + k)];
+                }
+            }
             // Skip next instruction if Vx = Vy.
-            if (CPU.V[hexa[1]] == CPU.V[hexa[2]]){
-                CPU.PC+=2;
+            else if (CPU.V[hexa[1]] == CPU.V[hexa[2]]){
+                skip_next();
             }
             break;
 
@@ -211,7 +324,7 @@ uint8_t interpret_opcode(uint16_t opcode){
         case 0x09: // 9xy0
             // Skip next instruction if Vx != Vy.
             if (CPU.V[hexa[1]] != CPU.V[hexa[2]]){
-                CPU.PC+=2;
+                skip_next();
             }
             break;
 
@@ -228,39 +341,66 @@ uint8_t interpret_opcode(uint16_t opcode){
 
         case 0x0C: // Cxkk
             // Set Vx = random byte AND kk.
-            CPU.V[hexa[1]] = (rand()%((hexa[2]<<4) + hexa[3] + 1));
+            CPU.V[hexa[1]] = (random_byte(&CPU.rng)%((hexa[2]<<4) + hexa[3] + 1));
             break;
 
-        case 0x0D: // Dxyn
-            // Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
+        case 0x0D: // Dxyn and Dxy0
+            // Display n-byte sprite (16x16 sprite if n = 0) starting at memory location I at (Vx, Vy), set VF = collision.
             draw_sprite(CPU.V[hexa[1]], CPU.V[hexa[2]], hexa[3]);
             break;
             
         case 0x0E: // Ex9E, ExA1
+            if (((hexa[2] == 0x9 && hexa[3] == 0xE) || (hexa[2] == 0xA && hexa[3] == 0x1)) && CPU.V[hexa[1]] >= NB_KEYS){
+                CPU.fault |= FAULT_KEY;
+            }
             if (hexa[2] == 0x9 && hexa[3] == 0xE){
                 // Skip next instruction if key with the value of Vx is pressed.
-                if (CPU.keyboard[CPU.V[hexa[1]]] == KEY_PRESSED){
-                    CPU.PC+=2;
+                if (CPU.keyboard[CPU.V[hexa[1]] & 0xF] == KEY_PRESSED){
+                    skip_next();
                 }
             }
             else if (hexa[2] == 0xA && hexa[3] == 0x1){
                 // Skip next instruction if key with the value of Vx is not pressed.
-                if (CPU.keyboard[CPU.V[hexa[1]]] == KEY_UNPRESSED){
-                    CPU.PC+=2;
+                if (CPU.keyboard[CPU.V[hexa[1]] & 0xF] == KEY_UNPRESSED){
+                    skip_next();
                 }
             }
             break;
 
-        case 0x0F: // Fx07, Fx0A, Fx15, Fx18, Fx1E, Fx29, Fx33, Fx55 and Fx65
+        case 0x0F: // F000, Fn01, F002, Fx07, Fx0A, Fx15, Fx18, Fx1E, Fx29, Fx30, Fx33, Fx3A, Fx55, Fx65, Fx75 and Fx85
             switch (hexa[2]){
-                case 0: // Fx07 and Fx0A
-                    if (hexa[3] == 0x7){ 
+                case 0: // F000, Fn01, F002, Fx07 and Fx0A
+                    if (hexa[1] == 0x0 && hexa[3] == 0x0){
+                        // Set I = nnnn, the 16 bits address following the opcode.
+                        CPU.I = (CPU.ram[(uint16_t) (CPU.PC+2)]<<8) + CPU.ram[(uint16_t) (CPU.PC+3)];
+                        CPU.PC+=2;
+                        CPU.xochip = 1;
+                    }
+                    else if (hexa[3] == 0x1){
+                        // Select the drawing planes n.
+                        select_planes(&CPU.screen, hexa[1]);
+                        CPU.xochip = 1;
+                    }
+                    else if (hexa[1] == 0x0 && hexa[3] == 0x2){
+                        // Load the 16 bytes audio pattern starting at location I.
+                        if (CPU.I + AUDIO_PATTERN_SIZE > MEMORY_SIZE){
+                            CPU.fault |= FAULT_MEMORY;
+                        }
+                        for (uint8_t k = 0; k < AUDIO_PATTERN_SIZE; k++){
+                            CPU.pattern[k] = CPU.ram[(uint16_t) (CPU.I + k)];
+                        }
+                        CPU.pattern_loaded = 1;
+                        CPU.xochip = 1;
+                    }
+                    else if (hexa[3] == 0x7){ 
                         // Set Vx = delay timer value.
                         CPU.V[hexa[1]] = CPU.delay;
                     }
                     else if (hexa[3] == 0xA){
-                        // Wait for a key press, store the value of the key in Vx.
-                        keep_up = wait_for_key(hexa[1]);
+                        // Wait for a key press, store the value of the key in Vx. PC stays here until set_key().
+                        CPU.waiting = 1;
+                        CPU.wait_register = hexa[1];
+                        CPU.PC-=2;
                     }
                     break;
 
@@ -277,8 +417,11 @@ uint8_t interpret_opcode(uint16_t opcode){
                             break;
 
                         case 0xE: // Fx1E
-                            // Set I = I + Vx.
-                            if (CPU.I + CPU.V[hexa[1]] > 0xFFF){
+                            // Set I = I + Vx. XO-CHIP programs wrap I on 16 bits, classic ones keep the 12 bits overflow.
+                            if (CPU.xochip){
+                                CPU.I += CPU.V[hexa[1]];
+                            }
+                            else if (CPU.I + CPU.V[hexa[1]] > 0xFFF){
                                 CPU.V[0xF] = 1;
                             }
                             else {
@@ -296,24 +439,58 @@ uint8_t interpret_opcode(uint16_t opcode){
                     CPU.I = 5*CPU.V[hexa[1]];
                     break;
 
-                case 0x03: // Fx33
+                case 0x03: // Fx30, Fx33 and Fx3A
+                    if (hexa[3] == 0x0){ // Fx30
+                        // Set I = location of the big sprite for digit Vx.
+                        CPU.I = BIG_DIGIT_AREA + BIG_HEX_REP_SIZE * (CPU.V[hexa[1]] & 0xF);
+                        break;
+                    }
+                    if (hexa[3] == 0xA){ // Fx3A
+                        // Set the audio pattern playback pitch = Vx.
+                        CPU.pitch = CPU.V[hexa[1]];
+                        CPU.xochip = 1;
+                        break;
+                    }
                     // Store BCD representation of Vx in memory locations I, I+1, and I+2.
+                    if (CPU.I + 2 >= MEMORY_SIZE){
+                        CPU.fault |= FAULT_MEMORY;
+                    }
                     CPU.ram[CPU.I] = (CPU.V[hexa[1]] - CPU.V[hexa[1]%100])/100;
-                    CPU.ram[CPU.I+1] = (((CPU.V[hexa[1]]-CPU.V[hexa[1]]%10)/10)%10);
-                    CPU.ram[CPU.I+2] = CPU.V[hexa[1]] - CPU.ram[CPU.I]*100 - CPU.ram[CPU.I+1]*10;
+                    CPU.ram[(uint16_t) (CPU.I+1)] = (((CPU.V[hexa[1]]-CPU.V[hexa[1]]%10)/10)%10);
+                    CPU.ram[(uint16_t) (CPU.I+2)] = CPU.V[hexa[1]] - CPU.ram[CPU.I]*100 - CPU.ram[(uint16_t) (CPU.I+1)]*10;
                     break;
 
                 case 0x05: // Fx55
                     // Store registers V0 through Vx in memory starting at location I.
+                    if (CPU.I + hexa[1] >= MEMORY_SIZE){
+                        CPU.fault |= FAULT_MEMORY;
+                    }
                     for (uint8_t k = 0x0; k <= hexa[1]; k++){
-                        CPU.ram[CPU.I + k] = CPU.V[k];
+                        CPU.ram[(uint16_t) (CPU.I + k)] = CPU.V[k];
                     }
                     break;
 
                 case 0x06: // Fx65
                     // Read registers V0 through Vx from memory starting at location I.
+                    if (CPU.I + hexa[1] >= MEMORY_SIZE){
+                        CPU.fault |= FAULT_MEMORY;
+                    }
                     for (uint8_t k = 0x00; k <= hexa[1]; k++){
-                        CPU.V[k] = CPU.ram[CPU.I + k];
+                        CPU.V[k] = CPU.ram[(uint16_t) (CPU.I + k)];
+                    }
+                    break;
+
+                case 0x07: // Fx75
+                    // Store V0 through Vx in RPL user flags.
+                    for (uint8_t k = 0x0; k <= hexa[1]; k++){
+                        CPU.rpl[k] = CPU.V[k];
+                    }
+                    break;
+
+                case 0x08: // Fx85
+                    // Read V0 through Vx from RPL user flags.
+                    for (uint8_t k = 0x0; k <= hexa[1]; k++){
+                        CPU.V[k] = CPU.rpl[k];
                     }
                     break;
                 
@@ -328,20 +505,82 @@ uint8_t interpret_opcode(uint16_t opcode){
 }
 
 /**
- * @brief Store the representation of 1, 2,3 ... C, D and F in ram starting at the 0 address.
+ * @brief Fetch the opcode at PC and execute it. It is recorded when the emulator is built with TRACE and tracing is on.
+ * 
+ * @return uint8_t 0 to stop the emulator, 1 otherwise.
+ */
+uint8_t step(){
+    uint16_t opcode = get_opcode();
+#ifdef TRACE
+    uint16_t PC = CPU.PC;
+    uint16_t I = CPU.I;
+    uint8_t keep_up = interpret_opcode(opcode);
+
+    if (trace_enabled){
+        trace_step(PC, opcode, I);
+    }
+    return keep_up;
+#else
+    return interpret_opcode(opcode);
+#endif
+}
+
+/**
+ * @brief Draw a random byte with a xorshift generator, its state belongs to the machine.
+ * 
+ * @param state State of the generator, never 0.
+ * @return uint8_t A random byte.
+ */
+uint8_t random_byte(uint32_t* state){
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x >> 24;
+}
+
+/**
+ * @brief Give the bytes of memory starting at address, wrapped to the start of memory when they go past its end.
+ * 
+ * @param ram The memory, MEMORY_SIZE bytes.
+ * @param address The first byte.
+ * @param length Number of bytes.
+ * @param buffer At least length bytes, receives a copy of the wrapped bytes.
+ * @return uint8_t* The bytes, in ram when they do not wrap, in buffer otherwise.
+ */
+uint8_t* wrap_memory(uint8_t* ram, uint16_t address, uint32_t length, uint8_t* buffer){
+    if (address + length <= MEMORY_SIZE){
+        return &ram[address];
+    }
+    for (uint32_t k = 0; k < length; k++){
+        buffer[k] = ram[(uint16_t) (address + k)];
+    }
+    return buffer;
+}
+
+/**
+ * @brief Replace the representation of 0, 1, 2 ... E and F copied by initialize() at the 0 address. Called once
+ * at startup, before the machines are initialized, the font then stays in memory.
  * 
  * @param digit_binary Path to the file conting the sprites. 
+ * @return uint8_t 0 if the file cannot be read, the built-in font is kept.
  */
-void load_digit(char* digit_binary){
+uint8_t load_digit(char* digit_binary){
+    uint8_t sprites[sizeof(digit)];
     FILE *bin_file = NULL;
     bin_file = fopen(digit_binary, "rb");
 
     if (bin_file == NULL){
-        fprintf(stderr, "Unable to load the digit file. ");
-        exit(EXIT_FAILURE);
+        return 0;
+    }
+    if (fread(sprites, sizeof(sprites), 1, bin_file) != 1){
+        fclose(bin_file);
+        return 0;
     }
-    fread(&CPU.ram[0], sizeof(uint8_t)*16* HEX_REP_SIZE, 1, bin_file);
     fclose(bin_file);
+    memcpy(digit, sprites, sizeof(digit));
+    return 1;
 }
 
 /**
@@ -363,74 +602,39 @@ void load_game(char* rom_name){
 }
 
 /**
- * @brief Draws a sprite for the opcode DXYN.
+ * @brief Draws a sprite for the opcode DXYN, or a 16x16 sprite for DXY0.
  * 
- * @param x X-coordinate value (0<=X<64).
- * @param y Y-coordinate value (0<=X<32).
- * @param height Size of the sprite in bytes.
+ * @param x X-coordinate value, wraps around the screen.
+ * @param y Y-coordinate value, wraps around the screen.
+ * @param height Size of the sprite in bytes, 0 for a 16x16 sprite.
  */
 void draw_sprite(uint8_t x, uint8_t y, uint8_t height){
-    
-    // loading sprite data from ram
-    uint8_t loaded_sprite[height];
-    for (uint8_t k = 0; k < height; k++){
-    loaded_sprite[k] = CPU.ram[CPU.I+k];
+    uint8_t buffer[PLANES * 32];
+    uint32_t length = (height == 0 ? 32 : height) * ((CPU.screen.planes & 1) + (CPU.screen.planes >> 1 & 1));
+    uint8_t* sprite = wrap_memory(CPU.ram, CPU.I, length, buffer);
+
+    if (sprite == buffer){
+        CPU.fault |= FAULT_MEMORY;
+    }
+    if (height == 0){
+        CPU.V[0xF] = blit_sprite(&CPU.screen, sprite, x, y, 16, 1);
     }
-    // Set VF at 0 by default
-    CPU.V[0x0F] = 0;
-
-    // Drawing the sprite in the screen table
-    for (uint8_t j = 0; j < height; j++){
-        for (uint8_t k = 0; k < 8; k++){            
-            if ((screen[(x+k)%SCREEN_WIDTH][(y+j)%SCREEN_HEIGTH].couleur == 1) && ((loaded_sprite[j]&(0x1<<(7-k)))>>(7-k)) == 1){
-                CPU.V[0xF] = 1;
-            };
-            screen[(x+k)% SCREEN_WIDTH][(y+j)%SCREEN_HEIGTH].couleur ^= (loaded_sprite[j]&(0x1<<(7-k)))>>(7-k);
-        }
+    else {
+        CPU.V[0xF] = blit_sprite(&CPU.screen, sprite, x, y, height, 0);
     }
 }
 
 /**
- * @brief Wait for user input for the opcode Fx0A
+ * @brief Press or release a key. A press ends the wait of Fx0A, the key goes in its register.
  * 
- * @param b Register value to store the result. (0<= b < 16)
+ * @param key The key, 0 to F.
+ * @param state KEY_PRESSED or KEY_UNPRESSED.
  */
-uint8_t wait_for_key(Uint8 b){
-    uint8_t wait = 1;
-    uint8_t keep_up = 1;
-    while (wait == 1){
-        SDL_WaitEvent(&sdl_event);
-        switch (sdl_event.type)
-        {
-        case SDL_QUIT:
-            wait = 0;
-            keep_up = 0;
-            break;
-
-        case SDL_KEYDOWN:
-            switch(sdl_event.key.keysym.sym){
-                case SDLK_0:{CPU.V[b] = 0x0; CPU.keyboard[0x0] = 1; wait = 0; break;}
-                case SDLK_1:{CPU.V[b] = 0x1; CPU.keyboard[0x1] = 1; wait = 0; break;}
-                case SDLK_2:{CPU.V[b] = 0x2; CPU.keyboard[0x2] = 1; wait = 0; break;}
-                case SDLK_3:{CPU.V[b] = 0x3; CPU.keyboard[0x3] = 1; wait = 0; break;}
-                case SDLK_4:{CPU.V[b] = 0x4; CPU.keyboard[0x4] = 1; wait = 0; break;}
-                case SDLK_5:{CPU.V[b] = 0x5; CPU.keyboard[0x5] = 1; wait = 0; break;}
-                case SDLK_6:{CPU.V[b] = 0x6; CPU.keyboard[0x6] = 1; wait = 0; break;}
-                case SDLK_7:{CPU.V[b] = 0x7; CPU.keyboard[0x7] = 1; wait = 0; break;}
-                case SDLK_8:{CPU.V[b] = 0x8; CPU.keyboard[0x8] = 1; wait = 0; break;}
-                case SDLK_9:{CPU.V[b] = 0x9; CPU.keyboard[0x9] = 1; wait = 0; break;}
-                case SDLK_a:{CPU.V[b] = 0xA; CPU.keyboard[0xA] = 1; wait = 0; break;}
-                case SDLK_b:{CPU.V[b] = 0xB; CPU.keyboard[0xB] = 1; wait = 0; break;}
-                case SDLK_c:{CPU.V[b] = 0xC; CPU.keyboard[0xC] = 1; wait = 0; break;}
-                case SDLK_d:{CPU.V[b] = 0xD; CPU.keyboard[0xD] = 1; wait = 0; break;}
-                case SDLK_e:{CPU.V[b] = 0xE; CPU.keyboard[0xE] = 1; wait = 0; break;}
-                case SDLK_f:{CPU.V[b] = 0xF; CPU.keyboard[0xF] = 1; wait = 0; break;}
-                default:
-                    break;  
-            }
-        default:
-            break;
-        }
+void set_key(uint8_t key, uint8_t state){
+    CPU.keyboard[key] = state;
+    if (state == KEY_PRESSED && CPU.waiting == 1){
+        CPU.V[CPU.wait_register] = key;
+        CPU.waiting = 0;
+        CPU.PC+=2;
     }
-    return keep_up;
 }
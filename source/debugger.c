@@ -0,0 +1,381 @@
+/**
+ * @file debugger.c
+ * @author Xavier Monard
+ * @brief Interactive debugger : PC breakpoints, memory and register watchpoints.
+ * It is an instrumented variant of the frame loop, the emulator only runs it
+ * while something is armed, otherwise step() runs alone.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "include/debugger.h"
+#include "include/cpu.h"
+#include "include/sound.h"
+#include "include/timing.h"
+#include "include/disassembler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+
+static uint8_t enabled = 0;
+static uint8_t paused = 0;
+static uint32_t steps = 0; // Instructions left to execute while paused
+static uint8_t resuming = 0; // Do not break again on the breakpoint we stopped at
+static uint8_t breakpoints[MEMORY_SIZE / 8];
+static uint32_t breakpoint_count = 0;
+static watchpoint watches[DEBUG_WATCHES];
+static uint8_t watch_map[MEMORY_SIZE]; // WATCH_READ and WATCH_WRITE flags of every byte
+static uint8_t watch_count = 0;
+static uint32_t watched_registers = 0; // Bits 0 to 15 for V0 to VF, WATCH_I for I
+static char line[DEBUG_LINE_SIZE];
+static size_t line_size = 0;
+
+/* Print the registers and the next instruction. */
+static void print_state(){
+    char text[MNEMONIC_SIZE];
+    uint16_t opcode = get_opcode();
+
+    disassemble(opcode, text, sizeof(text));
+    printf("%04X: %04X %-18s I=%04X DT=%02X ST=%02X SP=%X\n      ",
+           CPU.PC, opcode, text, CPU.I, CPU.delay, CPU.sound_timer, CPU.stack_pointer);
+    for (uint8_t k = 0; k < REGISTER_NUMBER; k++){
+        printf("V%X=%02X ", k, CPU.V[k]);
+    }
+    printf("\n");
+}
+
+/* Print every breakpoint and watchpoint. */
+static void print_list(){
+    for (uint32_t address = 0; address < MEMORY_SIZE; address++){
+        if (breakpoints[address >> 3] & (1 << (address & 7))){
+            printf("break %04X\n", address);
+        }
+    }
+    for (uint8_t k = 0; k < watch_count; k++){
+        printf("watch %s%s %04X, %u bytes\n", watches[k].kind & WATCH_READ ? "r" : "",
+               watches[k].kind & WATCH_WRITE ? "w" : "", watches[k].first, watches[k].length);
+    }
+    for (uint8_t k = 0; k <= WATCH_I; k++){
+        if (watched_registers & (1u << k)){
+            k == WATCH_I ? printf("watch I\n") : printf("watch V%X\n", k);
+        }
+    }
+}
+
+/* Rebuild the per byte flags after a watchpoint was removed. */
+static void rebuild_watch_map(){
+    memset(watch_map, 0, sizeof(watch_map));
+    for (uint8_t k = 0; k < watch_count; k++){
+        for (uint32_t j = 0; j < watches[k].length; j++){
+            watch_map[(uint16_t) (watches[k].first + j)] |= watches[k].kind;
+        }
+    }
+}
+
+/**
+ * @brief Memory range accessed by an instruction, derived from its opcode and I before it runs.
+ *
+ * @param opcode The instruction.
+ * @param length Number of accessed bytes starting at I.
+ * @return uint8_t WATCH_READ, WATCH_WRITE or 0 if the instruction does not access memory.
+ */
+static uint8_t memory_access(uint16_t opcode, uint32_t* length){
+    uint8_t x = (opcode >> 8) & 0xF;
+    uint8_t y = (opcode >> 4) & 0xF;
+    uint8_t n = opcode & 0xF;
+
+    switch (opcode & 0xF00F){
+        case 0x5002: // 5xy2
+            *length = (x > y ? x - y : y - x) + 1;
+            return WATCH_WRITE;
+        case 0x5003: // 5xy3
+            *length = (x > y ? x - y : y - x) + 1;
+            return WATCH_READ;
+        default:
+            break;
+    }
+    if ((opcode & 0xF000) == 0xD000){
+        // One sprite per selected plane, stored one after the other
+        uint8_t planes = (CPU.screen.planes & 1) + ((CPU.screen.planes >> 1) & 1);
+        *length = (n == 0 ? 32 : n) * planes;
+        return WATCH_READ;
+    }
+    switch (opcode & 0xF0FF){
+        case 0xF002:
+            *length = AUDIO_PATTERN_SIZE;
+            return opcode == 0xF002 ? WATCH_READ : 0;
+        case 0xF033:
+            *length = 3;
+            return WATCH_WRITE;
+        case 0xF055:
+            *length = x + 1;
+            return WATCH_WRITE;
+        case 0xF065:
+            *length = x + 1;
+            return WATCH_READ;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Execute one instruction with the breakpoints and watchpoints checked,
+ * the game is paused when one of them is hit.
+ *
+ * @param timed 1 to charge the instruction to the VIP cycle budget of the frame.
+ * @return uint8_t 0 to stop the emulator, 1 otherwise.
+ */
+static uint8_t debug_instruction(uint8_t timed){
+    uint16_t PC = CPU.PC;
+    uint16_t opcode = get_opcode();
+    uint16_t I = CPU.I;
+    uint8_t V[REGISTER_NUMBER];
+    uint32_t length = 0;
+    uint8_t kind;
+    uint8_t keep_up;
+    uint8_t hit = 0;
+
+    if (resuming == 0 && (breakpoints[PC >> 3] & (1 << (PC & 7)))){
+        printf("Breakpoint at %04X\n", PC);
+        paused = 1;
+        steps = 0;
+        return 1;
+    }
+    resuming = 0;
+
+    memcpy(V, CPU.V, sizeof(V));
+    kind = memory_access(opcode, &length);
+    keep_up = timed ? timed_step() : step();
+    executed++;
+
+    // Watchpoints stop after the instruction, as a hardware watchpoint would
+    for (uint32_t k = 0; k < length; k++){
+        uint16_t address = I + k;
+        if (watch_map[address] & kind){
+            printf("%s of %04X by %04X at %04X\n", kind == WATCH_WRITE ? "Write" : "Read", address, opcode, PC);
+            hit = 1;
+            break;
+        }
+    }
+    for (uint8_t k = 0; k < REGISTER_NUMBER; k++){
+        if ((watched_registers & (1u << k)) && V[k] != CPU.V[k]){
+            printf("V%X %02X -> %02X by %04X at %04X\n", k, V[k], CPU.V[k], opcode, PC);
+            hit = 1;
+        }
+    }
+    if ((watched_registers & (1u << WATCH_I)) && I != CPU.I){
+        printf("I %04X -> %04X by %04X at %04X\n", I, CPU.I, opcode, PC);
+        hit = 1;
+    }
+    if (hit){
+        paused = 1;
+        steps = 0;
+    }
+    return keep_up;
+}
+
+/**
+ * @brief Enable the debugger, the game is paused before its first instruction.
+ *
+ */
+void debug_open(){
+    enabled = 1;
+    paused = 1;
+    // The console may be a pipe, its answers must not wait for the buffer to fill
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("Debugger : b/w/r/a <hex address> [length], v <register>, d <hex address>, u <register>,\n");
+    printf("           s [n], c, p, x (state), l (list), clear. F5 continue, F6 step, F9 pause.\n");
+    print_state();
+}
+
+/**
+ * @brief Whether the debugger was enabled with --debug.
+ *
+ * @return uint8_t 1 if enabled.
+ */
+uint8_t debug_enabled(){
+    return enabled;
+}
+
+/**
+ * @brief Whether the instrumented frame loop is needed : the game is paused or something is armed.
+ *
+ * @return uint8_t 1 if debug_frame must run instead of the normal frame loop.
+ */
+uint8_t debug_needed(){
+    return paused || breakpoint_count > 0 || watch_count > 0 || watched_registers != 0;
+}
+
+/* Parse a register name, 0 to F or I, returns its bit in the watch mask. */
+static uint32_t register_bit(char* name){
+    if (name[0] == 'i' || name[0] == 'I'){
+        return 1u << WATCH_I;
+    }
+    if (name[0] == 'v' || name[0] == 'V'){
+        name++;
+    }
+    return 1u << (strtoul(name, NULL, 16) & 0xF);
+}
+
+/**
+ * @brief Execute a debugger command, from the console or from the debug keys.
+ *
+ * @param command The command line, without its new line.
+ */
+void debug_command(char* command){
+    char name[8] = "";
+    char argument[16] = "";
+    unsigned length = 1;
+    int count = sscanf(command, "%7s %15s %u", name, argument, &length);
+    uint32_t address = strtoul(argument, NULL, 16) & 0xFFFF;
+
+    if (enabled == 0 || count < 1){
+        return;
+    }
+    if (strcmp(name, "c") == 0){
+        paused = 0;
+        resuming = 1;
+    }
+    else if (strcmp(name, "s") == 0){
+        paused = 1;
+        resuming = 1;
+        steps = count >= 2 ? strtoul(argument, NULL, 10) : 1;
+    }
+    else if (strcmp(name, "p") == 0){
+        paused = 1;
+        steps = 0;
+        print_state();
+    }
+    else if (strcmp(name, "x") == 0){
+        print_state();
+    }
+    else if (strcmp(name, "l") == 0){
+        print_list();
+    }
+    else if (strcmp(name, "b") == 0 && count >= 2){
+        if ((breakpoints[address >> 3] & (1 << (address & 7))) == 0){
+            breakpoints[address >> 3] |= 1 << (address & 7);
+            breakpoint_count++;
+        }
+    }
+    else if ((strcmp(name, "w") == 0 || strcmp(name, "r") == 0 || strcmp(name, "a") == 0) && count >= 2){
+        if (watch_count == DEBUG_WATCHES || length == 0 || length > MEMORY_SIZE){
+            printf("Unable to add this watchpoint.\n");
+            return;
+        }
+        watches[watch_count].first = address;
+        watches[watch_count].length = length;
+        watches[watch_count].kind = name[0] == 'w' ? WATCH_WRITE : name[0] == 'r' ? WATCH_READ : WATCH_READ | WATCH_WRITE;
+        watch_count++;
+        rebuild_watch_map();
+    }
+    else if (strcmp(name, "v") == 0 && count >= 2){
+        watched_registers |= register_bit(argument);
+    }
+    else if (strcmp(name, "u") == 0 && count >= 2){
+        watched_registers &= ~register_bit(argument);
+    }
+    else if (strcmp(name, "d") == 0 && count >= 2){
+        // Remove the breakpoint and the watchpoints starting at the address
+        if (breakpoints[address >> 3] & (1 << (address & 7))){
+            breakpoints[address >> 3] &= ~(1 << (address & 7));
+            breakpoint_count--;
+        }
+        for (uint8_t k = 0; k < watch_count;){
+            if (watches[k].first == address){
+                watches[k] = watches[--watch_count];
+            }
+            else {
+                k++;
+            }
+        }
+        rebuild_watch_map();
+    }
+    else if (strcmp(name, "clear") == 0){
+        memset(breakpoints, 0, sizeof(breakpoints));
+        breakpoint_count = 0;
+        watch_count = 0;
+        watched_registers = 0;
+        rebuild_watch_map();
+    }
+    else {
+        printf("Unknown command %s\n", command);
+    }
+}
+
+/**
+ * @brief Execute the commands typed in the console since the last frame, stdin is never waited for.
+ *
+ */
+void debug_poll(){
+    struct pollfd console = {STDIN_FILENO, POLLIN, 0};
+
+    while (enabled && poll(&console, 1, 0) > 0 && (console.revents & POLLIN)){
+        char c;
+        if (read(STDIN_FILENO, &c, 1) != 1){
+            // End of the console, the game keeps running
+            console.fd = -1;
+            enabled = 0;
+            paused = 0;
+            break;
+        }
+        if (c == '\n'){
+            line[line_size] = '\0';
+            debug_command(line);
+            line_size = 0;
+        }
+        else if (line_size < DEBUG_LINE_SIZE - 1){
+            line[line_size++] = c;
+        }
+    }
+}
+
+/**
+ * @brief Instrumented frame loop, used instead of the normal one while debugging.
+ * The timers do not run while the game is paused, single steps included. Single steps are not charged
+ * to the cycle budget, a long stepping session would otherwise skip the frames after it.
+ *
+ * @param frame Number of the frame, to stamp the buzzer edges.
+ * @param timed 1 to run the frame on the VIP cycle budget, as run_timed_frame() does.
+ * @return uint8_t 0 to stop the emulator, 1 otherwise.
+ */
+uint8_t debug_frame(uint64_t frame, uint8_t timed){
+    uint8_t keep_up = 1;
+
+    if (paused){
+        if (steps > 0){
+            while (steps > 0 && keep_up == 1){
+                steps--;
+                keep_up = debug_instruction(0);
+            }
+            print_state();
+        }
+        update_buzzer((frame + 1) * SAMPLES_PER_FRAME);
+        return keep_up;
+    }
+    if (timed){
+        while (keep_up == 1 && paused == 0 && timing_frame_done() == 0){
+            keep_up = debug_instruction(1);
+            update_buzzer(frame * SAMPLES_PER_FRAME + timing_cycles() * SAMPLES_PER_FRAME / TIMING_BUDGET);
+        }
+        timing_next_frame();
+    }
+    else {
+        for (int actions = 0; actions<CPU_SPEED && keep_up == 1 && paused == 0; actions++){
+            keep_up = debug_instruction(0);
+            update_buzzer(frame * SAMPLES_PER_FRAME + (actions + 1) * SAMPLES_PER_FRAME / CPU_SPEED);
+        }
+    }
+    if (paused){
+        print_state();
+    }
+    time_count();
+    counted++;
+    update_buzzer((frame + 1) * SAMPLES_PER_FRAME);
+    return keep_up;
+}
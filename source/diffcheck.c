@@ -0,0 +1,351 @@
+/**
+ * @file diffcheck.c
+ * @author Xavier Monard
+ * @brief Differential checker : runs ROMs with the same key movie on the reference core and on
+ * another engine, in lockstep, and compares their states every few instructions. On a
+ * difference, it bisects to the first instruction executed differently and dumps both machines.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/diffcheck.h"
+#include "include/batch.h"
+#include "include/display.h"
+#include "include/disassembler.h"
+
+static cpu reference_machine;
+static batch* lanes = NULL;
+static uint8_t movie[DIFF_MOVIE_SIZE];
+static uint32_t movie_size = 0;
+
+/* The reference core : interpret_opcode through step(). */
+
+static void scalar_load(cpu* machine){
+    reference_machine = *machine;
+}
+
+static void scalar_store(cpu* machine){
+    *machine = reference_machine;
+}
+
+static uint8_t scalar_step(){
+    cpu_context = &reference_machine;
+    return step();
+}
+
+static void scalar_time_count(){
+    cpu_context = &reference_machine;
+    time_count();
+}
+
+static void scalar_key(uint8_t key, uint8_t state){
+    cpu_context = &reference_machine;
+    set_key(key, state);
+}
+
+/* The batch engine, with only its first lane active. */
+
+static void batch_engine_load(cpu* machine){
+    if (lanes == NULL){
+        lanes = batch_create(machine);
+    }
+    batch_load(lanes, 0, machine);
+    for (uint8_t l = 1; l < BATCH_LANES; l++){
+        lanes->active[l] = LANE_OFF;
+    }
+}
+
+static void batch_engine_store(cpu* machine){
+    batch_store(lanes, 0, machine);
+}
+
+static uint8_t batch_engine_step(){
+    batch_step(lanes);
+    return lanes->active[0] == LANE_ON;
+}
+
+static void batch_engine_time_count(){
+    batch_time_count(lanes);
+}
+
+static void batch_engine_key(uint8_t key, uint8_t state){
+    batch_key(lanes, 0, key, state);
+}
+
+static const engine reference = {"scalar", scalar_load, scalar_store, scalar_step, scalar_time_count, scalar_key};
+static const engine engines[] = {
+    {"batch", batch_engine_load, batch_engine_store, batch_engine_step, batch_engine_time_count, batch_engine_key},
+};
+
+/**
+ * @brief Hash the registers shared by all the engines, the memory is compared apart. The faults are only tracked by the reference core.
+ *
+ * @param m The machine.
+ * @return uint64_t The hash.
+ */
+static uint64_t state_hash(cpu* m){
+    uint64_t hash = HASH_SEED;
+    hash = hash_bytes(hash, m->V, sizeof(m->V));
+    hash = hash_bytes(hash, &m->I, sizeof(m->I));
+    hash = hash_bytes(hash, &m->PC, sizeof(m->PC));
+    hash = hash_bytes(hash, &m->delay, sizeof(m->delay));
+    hash = hash_bytes(hash, &m->sound_timer, sizeof(m->sound_timer));
+    hash = hash_bytes(hash, m->stack, sizeof(m->stack));
+    hash = hash_bytes(hash, &m->stack_pointer, sizeof(m->stack_pointer));
+    hash = hash_bytes(hash, m->keyboard, sizeof(m->keyboard));
+    hash = hash_bytes(hash, &m->screen, sizeof(m->screen));
+    hash = hash_bytes(hash, m->rpl, sizeof(m->rpl));
+    hash = hash_bytes(hash, m->pattern, sizeof(m->pattern));
+    hash = hash_bytes(hash, &m->pattern_loaded, sizeof(m->pattern_loaded));
+    hash = hash_bytes(hash, &m->pitch, sizeof(m->pitch));
+    hash = hash_bytes(hash, &m->rng, sizeof(m->rng));
+    hash = hash_bytes(hash, &m->waiting, sizeof(m->waiting));
+    hash = hash_bytes(hash, &m->wait_register, sizeof(m->wait_register));
+    return hash_bytes(hash, &m->xochip, sizeof(m->xochip));
+}
+
+/* 1 if both machines are in the same state, their whole 64KB memory included. */
+static uint8_t same_state(cpu* a, cpu* b){
+    return state_hash(a) == state_hash(b) && memcmp(a->ram, b->ram, MEMORY_SIZE) == 0;
+}
+
+/**
+ * @brief Run instructions of the movie on an engine. Keys change and timers decrement every CPU_SPEED instructions, as in the emulator.
+ *
+ * @param e The engine.
+ * @param p Its position in the movie.
+ * @param count Number of instructions.
+ */
+static void advance(const engine* e, position* p, uint64_t count){
+    for (uint64_t k = 0; k < count && p->exited == 0; k++){
+        if (p->executed % CPU_SPEED == 0){
+            uint64_t frame = p->executed / CPU_SPEED;
+            uint8_t key = frame < movie_size ? movie[frame] : NO_KEY;
+            if (key != p->held){
+                if (p->held != NO_KEY){
+                    e->key(p->held, KEY_UNPRESSED);
+                }
+                if (key != NO_KEY){
+                    e->key(key, KEY_PRESSED);
+                }
+                p->held = key;
+            }
+        }
+        if (e->step() == 0){
+            p->exited = 1;
+        }
+        p->executed++;
+        if (p->executed % CPU_SPEED == 0){
+            e->time_count();
+        }
+    }
+}
+
+/* Print the machine, its registers then the fields differing from the other machine. */
+static void dump(const char* name, cpu* m, cpu* other){
+    char text[MNEMONIC_SIZE];
+    uint16_t opcode = (m->ram[m->PC] << 8) | m->ram[(uint16_t) (m->PC + 1)];
+
+    disassemble(opcode, text, sizeof(text));
+    printf("  %-7s PC=%04X %04X %-20s I=%04X SP=%X DT=%02X ST=%02X V=", name, m->PC, opcode, text, m->I,
+           m->stack_pointer, m->delay, m->sound_timer);
+    for (uint8_t k = 0; k < REGISTER_NUMBER; k++){
+        printf("%02X%s", m->V[k], k + 1 < REGISTER_NUMBER ? " " : "\n");
+    }
+    for (uint32_t k = 0, shown = 0; k < MEMORY_SIZE && shown < 8; k++){
+        if (m->ram[k] != other->ram[k]){
+            printf("          ram[%04X]=%02X\n", k, m->ram[k]);
+            shown++;
+        }
+    }
+    for (uint8_t p = 0; p < PLANES; p++){
+        for (uint8_t y = 0; y < SCREEN_HEIGTH; y++){
+            if (memcmp(m->screen.rows[p][y], other->screen.rows[p][y], sizeof(m->screen.rows[p][y])) != 0){
+                printf("          screen plane %u row %u differs\n", p, y);
+            }
+        }
+    }
+    if (memcmp(m->stack, other->stack, sizeof(m->stack)) != 0 || m->rng != other->rng || m->waiting != other->waiting
+        || memcmp(m->keyboard, other->keyboard, sizeof(m->keyboard)) != 0){
+        printf("          stack, keys, rng %08X or waiting %u differ\n", m->rng, m->waiting);
+    }
+}
+
+/**
+ * @brief Find the first instruction after which the engines differ, replaying from the last matching states.
+ *
+ * @param e The engine checked.
+ * @param start_reference Reference machine at the last match.
+ * @param start_engine Checked machine at the last match.
+ * @param start Position of both at the last match.
+ * @param count Instructions after which they differ.
+ */
+static void bisect(const engine* e, cpu* start_reference, cpu* start_engine, position start, uint64_t count){
+    static cpu a, b;
+    uint64_t low = 0, high = count;
+
+    while (high - low > 1){
+        uint64_t middle = (low + high) / 2;
+        position p = start, q = start;
+
+        reference.load(start_reference);
+        e->load(start_engine);
+        advance(&reference, &p, middle);
+        advance(e, &q, middle);
+        reference.store(&a);
+        e->store(&b);
+        if (same_state(&a, &b) && p.exited == q.exited){
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    position p = start, q = start;
+    reference.load(start_reference);
+    e->load(start_engine);
+    advance(&reference, &p, low);
+    advance(e, &q, low);
+    reference.store(&a);
+    e->store(&b);
+    printf("  instruction %lu (frame %lu), before :\n", (unsigned long) p.executed, (unsigned long) (p.executed / CPU_SPEED));
+    dump(reference.name, &a, &b);
+    dump(e->name, &b, &a);
+    advance(&reference, &p, 1);
+    advance(e, &q, 1);
+    reference.store(&a);
+    e->store(&b);
+    printf("  after :\n");
+    dump(reference.name, &a, &b);
+    dump(e->name, &b, &a);
+}
+
+/* Read the movie file. */
+static void load_movie(char* name){
+    FILE* file = fopen(name, "r");
+
+    if (file == NULL){
+        fprintf(stderr, "Unable to read the movie %s.\n", name);
+        exit(EXIT_FAILURE);
+    }
+    movie_size = read_movie(file, movie, DIFF_MOVIE_SIZE);
+    fclose(file);
+}
+
+/**
+ * @brief Run a ROM on the reference core and an engine, comparing their states every few instructions.
+ *
+ * @param e The engine checked.
+ * @param rom_name The ROM.
+ * @param frames Frames to run.
+ * @param every Instructions between two comparisons.
+ * @return uint8_t 1 if the engines agreed.
+ */
+static uint8_t check(const engine* e, char* rom_name, uint32_t frames, uint64_t every){
+    static cpu start, states[4];
+    // The states at the last match and the current states, swapped after each match
+    cpu* matched_reference = &states[0];
+    cpu* matched_engine = &states[1];
+    cpu* now_reference = &states[2];
+    cpu* now_engine = &states[3];
+    position p = {0, NO_KEY, 0}, q = {0, NO_KEY, 0};
+    uint64_t total = (uint64_t) frames * CPU_SPEED;
+
+    cpu_context = &start;
+    initialize();
+    load_game(rom_name);
+
+    reference.load(&start);
+    e->load(&start);
+    *matched_reference = start;
+    *matched_engine = start;
+    while (p.executed < total && p.exited == 0){
+        position p0 = p;
+        uint64_t count = total - p.executed < every ? total - p.executed : every;
+
+        advance(&reference, &p, count);
+        advance(e, &q, count);
+        reference.store(now_reference);
+        e->store(now_engine);
+        if (same_state(now_reference, now_engine) == 0 || p.exited != q.exited){
+            printf("%s : %s differs from %s\n", rom_name, e->name, reference.name);
+            bisect(e, matched_reference, matched_engine, p0, count);
+            return 0;
+        }
+        cpu* swap = matched_reference;
+        matched_reference = now_reference;
+        now_reference = swap;
+        swap = matched_engine;
+        matched_engine = now_engine;
+        now_engine = swap;
+    }
+    printf("%s : %s matches %s for %lu instructions%s\n", rom_name, e->name, reference.name, (unsigned long) p.executed,
+           p.exited ? " (exited)" : "");
+    return 1;
+}
+
+int main(int argc, char* argv[]){
+    const engine* e = &engines[0];
+    uint32_t frames = DIFF_FRAMES;
+    uint64_t every = CPU_SPEED;
+    uint32_t seed = RNG_SEED;
+    char* movie_name = NULL;
+    int first_rom = argc;
+
+    for (int k = 1; k < argc && first_rom == argc; k++){
+        if (strcmp(argv[k], "--engine") == 0 && k + 1 < argc){
+            k++;
+            e = NULL;
+            for (size_t n = 0; n < sizeof(engines) / sizeof(engines[0]); n++){
+                if (strcmp(argv[k], engines[n].name) == 0){
+                    e = &engines[n];
+                }
+            }
+        }
+        else if (strcmp(argv[k], "--frames") == 0 && k + 1 < argc){
+            frames = strtoul(argv[++k], NULL, 10);
+        }
+        else if (strcmp(argv[k], "--every") == 0 && k + 1 < argc){
+            every = strtoull(argv[++k], NULL, 10);
+        }
+        else if (strcmp(argv[k], "--movie") == 0 && k + 1 < argc){
+            movie_name = argv[++k];
+        }
+        else if (strcmp(argv[k], "--seed") == 0 && k + 1 < argc){
+            seed = strtoul(argv[++k], NULL, 0);
+        }
+        else {
+            first_rom = k;
+        }
+    }
+    if (first_rom == argc || e == NULL || every == 0){
+        printf("You must give at least one rom.\n");
+        printf("Usage : %s [--engine batch] [--frames <n>] [--every <instructions>] [--movie <keys file>] [--seed <n>] <rom>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (movie_name != NULL){
+        load_movie(movie_name);
+    }
+    else {
+        movie_size = frames < DIFF_MOVIE_SIZE ? frames : DIFF_MOVIE_SIZE;
+        generate_movie(movie, movie_size, seed);
+    }
+
+    uint32_t failures = 0;
+    Uint64 timer = SDL_GetPerformanceCounter();
+    for (int k = first_rom; k < argc; k++){
+        failures += check(e, argv[k], frames, every) == 0;
+    }
+    printf("%d roms, %u differing, %.2fs\n", argc - first_rom, failures,
+           (double) (SDL_GetPerformanceCounter() - timer) / SDL_GetPerformanceFrequency());
+    if (lanes != NULL){
+        batch_destroy(lanes);
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,257 @@
+/**
+ * @file disassembler.c
+ * @author Xavier Monard
+ * @brief Mnemonics of the CHIP-8, SUPER-CHIP and XO-CHIP instructions, shared by the translator and the trace tool.
+ * @version 0.1
+ * @date 2023-06-01
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include "include/disassembler.h"
+
+/**
+ * @brief Write the mnemonic of an opcode split in 4 nibbles.
+ * 
+ * @param hexa The 4 nibbles of the opcode, most significant first.
+ * @param text Output buffer, empty string for an unknown opcode.
+ * @param size Size of the output buffer.
+ */
+void translate_opcode(int* hexa, char* text, size_t size){
+    text[0] = '\0';
+
+    switch(hexa[0]){
+        case 0x0:
+            if (hexa[2] == 0xE && hexa[3] == 0x0){
+                snprintf(text, size, "CLS");
+            } else if (hexa[2] == 0xE && hexa[3] == 0xE){
+                snprintf(text, size, "RET");
+            } else if (hexa[1] == 0x0 && hexa[2] == 0xC){
+                snprintf(text, size, "SCD %d", hexa[3]);
+            } else if (hexa[1] == 0x0 && hexa[2] == 0xD){
+                snprintf(text, size, "SCU %d", hexa[3]);
+            } else if (hexa[1] == 0x0 && hexa[2] == 0xF && hexa[3] == 0xB){
+                snprintf(text, size, "SCR");
+            } else if (hexa[1] == 0x0 && hexa[2] == 0xF && hexa[3] == 0xC){
+                snprintf(text, size, "SCL");
+            } else if (hexa[1] == 0x0 && hexa[2] == 0xF && hexa[3] == 0xD){
+                snprintf(text, size, "EXIT");
+            } else if (hexa[1] == 0x0 && hexa[2] == 0xF && hexa[3] == 0xE){
+                snprintf(text, size, "LOW");
+            } else if (hexa[1] == 0x0 && hexa[2] == 0xF && hexa[3] == 0xF){
+                snprintf(text, size, "HIGH");
+            } else {
+                snprintf(text, size, "SYS %X", (hexa[1]<<8)+(hexa[2]<<4)+hexa[3]);
+            }
+            break;
+
+        case 0x1:
+            snprintf(text, size, "JP %d", (hexa[1]<<8)+(hexa[2]<<4)+hexa[3]);
+            break;
+
+        case 0x2:
+            snprintf(text, size, "CALL %d",(hexa[1]<<8)+(hexa[2]<<4)+hexa[3]);
+            break;
+
+        case 0x3:
+            snprintf(text, size, "SE V%X, %d",hexa[1],((hexa[2]<<4)+hexa[3]));
+            break;
+
+        case 0x4:
+            snprintf(text, size, "SNE V%X, %d",hexa[1],((hexa[2]<<4)+hexa[3]));
+            break;
+
+        case 0x5:
+            if (hexa[3] == 0x2){
+                snprintf(text, size, "SAVE V%X - V%X",hexa[1],hexa[2]);
+            } else if (hexa[3] == 0x3){
+                snprintf(text, size, "LOAD V%X - V%X",hexa[1],hexa[2]);
+            } else {
+                snprintf(text, size, "SE V%X,V%X",hexa[1],hexa[2]);
+            }
+            break;
+
+        case 0x6:
+            snprintf(text, size, "LD V%X, %d", hexa[1], ((hexa[2]<<4)+hexa[3]));
+            break;
+            
+        case 0x7:
+            snprintf(text, size, "ADD V%X, V%X",hexa[1],hexa[2]);
+            break;
+
+        case 0x8:
+            switch(hexa[3]){
+                case 0x0:
+                    snprintf(text, size, "LD V%X, V%X", hexa[1], hexa[2]);
+                    break;
+
+                case 0x1:
+                    snprintf(text, size, "OR V%X, V%X", hexa[1], hexa[2]);
+                    break;
+
+                case 0x2:
+                    snprintf(text, size, "AND V%X, V%X", hexa[1], hexa[2]);
+                    break;
+
+                case 0x3:
+                    snprintf(text, size, "XOR V%X, V%X", hexa[1], hexa[2]);
+                    break;
+
+                case 0x4:
+                    snprintf(text, size, "ADD V%X, V%X", hexa[1], hexa[2]);
+                    break;
+
+                case 0x5:
+                    snprintf(text, size, "SUB V%X, V%X", hexa[1], hexa[2]);
+                    break;
+
+                case 0x6:
+                    snprintf(text, size, "SHR V%X {, V%X}", hexa[1], hexa[2]);
+                    break;
+
+                case 0x7:
+                    snprintf(text, size, "SUBN V%X, V%X", hexa[1], hexa[2]);
+                    break;
+
+                case 0xE:
+                    snprintf(text, size, "SHL V%X {, V%X}", hexa[1], hexa[2]);
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+            
+        case 0x9:
+            snprintf(text, size, "SNE V%X, V%X",hexa[1],hexa[2]);
+            break;
+
+        case 0xA:
+            snprintf(text, size, "LD I, %d", ((hexa[1]<<8)+(hexa[2]<<4)+hexa[3]));
+            break;
+
+        case 0xB:
+            snprintf(text, size, "JP V0, %d",((hexa[1]<<8)+(hexa[2]<<4)+hexa[3]));
+            break;
+
+        case 0xC:
+            snprintf(text, size, "RND V%X, %X",hexa[1], ((hexa[2]<<4)+hexa[3]));
+            break;
+
+        case 0xD:
+            snprintf(text, size, "DRW V%X, V%X, %d",hexa[1],hexa[2],hexa[3]);
+            break;
+
+        case 0xE:
+            switch(hexa[3]){
+                case 0xE:
+                    snprintf(text, size, "SKP V%X",hexa[1]);
+                    break;
+
+                case 0x1:
+                    snprintf(text, size, "SKNP V%X",hexa[1]);
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+
+        case 0xF:{
+            switch(hexa[3]){
+                case 0x7:
+                    snprintf(text, size, "LD V%X, DT",hexa[1]);
+                    break;
+
+                case 0xA:
+                    if (hexa[2] == 0x3){
+                        snprintf(text, size, "PITCH V%X",hexa[1]);
+                    } else {
+                        snprintf(text, size, "LD V%X, K",hexa[1]);
+                    }
+                    break;
+
+                case 0x1:
+                    if (hexa[2] == 0x0){
+                        snprintf(text, size, "PLANE %d",hexa[1]);
+                    }
+                    break;
+
+                case 0x2:
+                    if (hexa[1] == 0x0 && hexa[2] == 0x0){
+                        snprintf(text, size, "AUDIO");
+                    }
+                    break;
+
+                case 0x5:
+                    switch(hexa[2]){
+                        case 0x1:
+                            snprintf(text, size, "LD DT, V%X",hexa[1]);
+                            break;
+
+                        case 0x5:
+                            snprintf(text, size, "LD [I], V%X", hexa[1]);
+                            break;
+
+                        case 0x6:
+                            snprintf(text, size, "LD V%X, [I]", hexa[1]);
+                            break;
+
+                        case 0x7:
+                            snprintf(text, size, "LD R, V%X", hexa[1]);
+                            break;
+
+                        case 0x8:
+                            snprintf(text, size, "LD V%X, R", hexa[1]);
+                            break;
+
+                        default:
+                            break;
+                    }
+                    break;
+
+                case 0x0:
+                    if (hexa[2] == 0x3){
+                        snprintf(text, size, "LD HF, V%X", hexa[1]);
+                    }
+                    break;
+
+                case 0x8:
+                    snprintf(text, size, "LD ST, V%X",hexa[1]);
+                    break;
+
+                case 0xE:
+                    snprintf(text, size, "ADD I, V%X", hexa[1]);
+                    break;
+
+                case 0x9:
+                    snprintf(text, size, "LD F, V%X", hexa[1]);
+                    break;
+
+                case 0x3:
+                    snprintf(text, size, "LD B, V%X", hexa[1]);
+                    break;
+            }
+        }
+
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Write the mnemonic of a 2 bytes opcode.
+ * 
+ * @param opcode A 2 bytes opcode.
+ * @param text Output buffer, empty string for an unknown opcode.
+ * @param size Size of the output buffer.
+ */
+void disassemble(uint16_t opcode, char* text, size_t size){
+    int hexa[4];
+
+    for (uint8_t i = 0; i < 4; i++){
+        hexa[i] = (opcode >> (12 - 4 * i)) & 0xF;
+    }
+    translate_opcode(hexa, text, size);
+}
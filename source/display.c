@@ -9,54 +9,316 @@
  * 
  */
 #include "include/display.h"
+#include "include/cpu.h"
 #include <stdio.h>
+#include <string.h>
 
 /* Global variables */
-pixel screen[SCREEN_WIDTH][SCREEN_HEIGTH];
-SDL_Texture *sdl_texture[2];
+SDL_Texture *sdl_texture;
 SDL_Window * sdl_window;
 SDL_Renderer * sdl_renderer;
 SDL_Event sdl_event;
+/* Texels of the 8 pixels of every byte of the first plane, filled by initialize_sdl(). */
+static uint32_t expanded[256][8];
 
-
-/// @brief Initialize all the pixel of the screen set at black value.
+/// @brief Set the screen in low resolution with all the pixels at black value, drawing in the first plane.
 void initialize_screen(){
-    for (uint8_t x = 0; x < SCREEN_WIDTH; x++){
-        for (uint8_t y = 0; y < SCREEN_HEIGTH; y++){
-            screen[x][y].position.x = x * PIXEL_SIZE;
-            screen[x][y].position.y = y * PIXEL_SIZE;
-            screen[x][y].position.h = PIXEL_SIZE;
-            screen[x][y].position.w = PIXEL_SIZE;
-            screen[x][y].couleur = PIXEL_BLACK;
+    select_planes(&CPU.screen, 1);
+    set_resolution(&CPU.screen, 0);
+}
+
+/* Draw the screen in the buffer and update it to the renderer. */
+void update_screen(){
+    render_framebuffer(&CPU.screen);
+}
+
+/* Set the value of the whole screen to black. */
+void clear_screen(){
+    clear_framebuffer(&CPU.screen);
+}
+
+/**
+ * @brief Composite the two planes of a packed framebuffer in the streaming texture and present it, scaled to the window.
+ * The texels are written a word of 64 pixels at a time, 8 at a time from a table while the second plane is empty.
+ * 
+ * @param fb The framebuffer to display.
+ */
+void render_framebuffer(framebuffer* fb){
+    static const uint32_t palette[1 << PLANES] = {COLOR_BLACK, COLOR_WHITE, COLOR_PLANE_2, COLOR_BOTH_PLANES};
+    uint8_t width = fb->hires ? SCREEN_WIDTH : LORES_WIDTH;
+    uint8_t height = fb->hires ? SCREEN_HEIGTH : LORES_HEIGTH;
+    SDL_Rect source = {0, 0, width, height};
+    void* pixels;
+    int pitch;
+
+    if (SDL_LockTexture(sdl_texture, &source, &pixels, &pitch) != 0){
+        return;
+    }
+    for (uint8_t y = 0; y < height; y++){
+        uint32_t* line = (uint32_t*) ((uint8_t*) pixels + y * pitch);
+        for (uint8_t w = 0; w < width / 64; w++){
+            uint64_t first = fb->rows[0][y][w];
+            uint64_t second = fb->rows[1][y][w];
+
+            if (second == 0){
+                // Only the first plane is lit, as in every game but XO-CHIP ones : 8 pixels per copy
+                for (uint8_t x = 0; x < 64; x += 8){
+                    memcpy(line + x, expanded[(first >> (56 - x)) & 0xFF], sizeof(expanded[0]));
+                }
+            }
+            else {
+                for (uint8_t x = 0; x < 64; x++){
+                    line[x] = palette[(first >> 63) | ((second >> 63) << 1)];
+                    first <<= 1;
+                    second <<= 1;
+                }
+            }
+            line += 64;
         }
     }
+    SDL_UnlockTexture(sdl_texture);
+
+    SDL_RenderCopy(sdl_renderer, sdl_texture, &source, NULL);
+    SDL_RenderPresent(sdl_renderer);
 }
 
-/* Load the texture to the buffer of one pixel. */
-void draw_pixel(pixel pixel){
-    SDL_RenderCopy(sdl_renderer, sdl_texture[pixel.couleur], NULL, &pixel.position);
+/**
+ * @brief Write a framebuffer as a binary PBM image, a pixel is black when it is lit in a plane.
+ * 
+ * @param file The image file, opened in binary mode.
+ * @param fb The framebuffer to write.
+ */
+void write_pbm(FILE* file, framebuffer* fb){
+    uint8_t width = fb->hires ? SCREEN_WIDTH : LORES_WIDTH;
+    uint8_t height = fb->hires ? SCREEN_HEIGTH : LORES_HEIGTH;
+
+    fprintf(file, "P4\n%u %u\n", width, height);
+    for (uint8_t y = 0; y < height; y++){
+        for (uint8_t x = 0; x < width; x += 8){
+            uint8_t shift = 56 - (x & 63);
+            fputc((uint8_t) ((fb->rows[0][y][x >> 6] | fb->rows[1][y][x >> 6]) >> shift), file);
+        }
+    }
 }
 
-/* Draw the screen in the buffer and update it to the renderer. */
-void update_screen(){
-    for (uint8_t x = 0; x < SCREEN_WIDTH; x++){
+/**
+ * @brief Set every pixel of the selected planes to black (00E0).
+ * 
+ * @param fb The framebuffer to clear.
+ */
+void clear_framebuffer(framebuffer* fb){
+    for (uint8_t p = 0; p < PLANES; p++){
+        if (fb->planes & (1 << p)){
+            memset(fb->rows[p], 0, sizeof(fb->rows[p]));
+        }
+    }
+}
+
+/**
+ * @brief Switch between the 64x32 and the 128x64 mode, every plane is cleared (00FE and 00FF).
+ * 
+ * @param fb The framebuffer to switch.
+ * @param hires 1 for the 128x64 mode, 0 for the 64x32 mode.
+ */
+void set_resolution(framebuffer* fb, uint8_t hires){
+    fb->hires = hires;
+    memset(fb->rows, 0, sizeof(fb->rows));
+}
+
+/**
+ * @brief Select the planes affected by the next drawing operations (Fn01).
+ * 
+ * @param fb The framebuffer.
+ * @param planes Bitmask of planes, 0 to 3.
+ */
+void select_planes(framebuffer* fb, uint8_t planes){
+    fb->planes = planes & ((1 << PLANES) - 1);
+}
+
+/* Rotate a 64 bits word to the right. */
+static uint64_t rotate_right(uint64_t word, uint8_t shift){
+    return shift == 0 ? word : (word >> shift) | (word << (64 - shift));
+}
+
+/**
+ * @brief Place a left aligned sprite line at column x of a packed row, wrapping around the screen.
+ * 
+ * @param bits Sprite line, its first pixel is the most significant bit.
+ * @param x Column of the first pixel (x < width of the mode).
+ * @param hires Screen mode.
+ * @param line Output row, ROW_WORDS words in high resolution and 1 word in low resolution.
+ */
+static void place_line(uint64_t bits, uint8_t x, uint8_t hires, uint64_t* line){
+    if (hires == 0){
+        line[0] = rotate_right(bits, x);
+        return;
+    }
+
+    // 128 bits rotation, a rotation of 64 swaps the two words
+    uint64_t high = bits;
+    uint64_t low = 0;
+    if (x >= 64){
+        high = 0;
+        low = bits;
+        x -= 64;
+    }
+    if (x == 0){
+        line[0] = high;
+        line[1] = low;
+    }
+    else {
+        line[0] = (high >> x) | (low << (64 - x));
+        line[1] = (low >> x) | (high << (64 - x));
+    }
+}
+
+/**
+ * @brief XOR a sprite on the selected planes of a framebuffer, one packed row at a time.
+ * 
+ * When both planes are selected, the sprite data of the second plane follows the one of the first plane
+ * and each row is drawn in the two planes in the same pass.
+ * 
+ * @param fb The framebuffer to draw in.
+ * @param sprite Sprite data, 1 byte per line or 2 bytes per line if wide.
+ * @param x X-coordinate value, wraps around the screen.
+ * @param y Y-coordinate value, wraps around the screen.
+ * @param height Number of lines of the sprite.
+ * @param wide 1 for the 16 pixels wide SUPER-CHIP sprites (Dxy0).
+ * @return uint8_t 1 if a pixel was turned off, 0 otherwise.
+ */
+uint8_t blit_sprite(framebuffer* fb, uint8_t* sprite, uint8_t x, uint8_t y, uint8_t height, uint8_t wide){
+    uint8_t width = fb->hires ? SCREEN_WIDTH : LORES_WIDTH;
+    uint8_t rows = fb->hires ? SCREEN_HEIGTH : LORES_HEIGTH;
+    uint8_t words = fb->hires ? ROW_WORDS : 1;
+    uint8_t bytes = wide ? 2 * height : height;
+    uint64_t (*plane[PLANES])[ROW_WORDS];
+    uint8_t* data[PLANES];
+    uint8_t count = 0;
+    uint64_t line[ROW_WORDS];
+    uint64_t collision = 0;
+
+    for (uint8_t p = 0; p < PLANES; p++){
+        if (fb->planes & (1 << p)){
+            plane[count] = fb->rows[p];
+            data[count] = sprite + count * bytes;
+            count++;
+        }
+    }
+
+    x %= width;
+    y %= rows;
+    for (uint8_t j = 0; j < height; j++){
+        uint8_t row_index = (y + j) % rows;
+        for (uint8_t p = 0; p < count; p++){
+            uint64_t bits;
+            if (wide){
+                bits = (uint64_t) ((data[p][2 * j] << 8) | data[p][2 * j + 1]) << 48;
+            }
+            else {
+                bits = (uint64_t) data[p][j] << 56;
+            }
+            if (bits == 0){
+                continue;
+            }
+            place_line(bits, x, fb->hires, line);
+
+            uint64_t* row = plane[p][row_index];
+            for (uint8_t w = 0; w < words; w++){
+                collision |= row[w] & line[w];
+                row[w] ^= line[w];
+            }
+        }
+    }
+    return collision != 0;
+}
+
+/**
+ * @brief Scroll the selected planes down by n pixels (00Cn).
+ * 
+ * @param fb The framebuffer to scroll.
+ * @param n Number of rows, in pixels of the current mode.
+ */
+void scroll_down(framebuffer* fb, uint8_t n){
+    uint8_t rows = fb->hires ? SCREEN_HEIGTH : LORES_HEIGTH;
+
+    if (n > rows){
+        n = rows;
+    }
+    for (uint8_t p = 0; p < PLANES; p++){
+        if (fb->planes & (1 << p)){
+            memmove(fb->rows[p][n], fb->rows[p][0], (rows - n) * sizeof(fb->rows[p][0]));
+            memset(fb->rows[p][0], 0, n * sizeof(fb->rows[p][0]));
+        }
+    }
+}
+
+/**
+ * @brief Scroll the selected planes up by n pixels (XO-CHIP 00Dn).
+ * 
+ * @param fb The framebuffer to scroll.
+ * @param n Number of rows, in pixels of the current mode.
+ */
+void scroll_up(framebuffer* fb, uint8_t n){
+    uint8_t rows = fb->hires ? SCREEN_HEIGTH : LORES_HEIGTH;
+
+    if (n > rows){
+        n = rows;
+    }
+    for (uint8_t p = 0; p < PLANES; p++){
+        if (fb->planes & (1 << p)){
+            memmove(fb->rows[p][0], fb->rows[p][n], (rows - n) * sizeof(fb->rows[p][0]));
+            memset(fb->rows[p][rows - n], 0, n * sizeof(fb->rows[p][0]));
+        }
+    }
+}
+
+/**
+ * @brief Scroll the selected planes right by 4 pixels (00FB).
+ * 
+ * @param fb The framebuffer to scroll.
+ */
+void scroll_right(framebuffer* fb){
+    for (uint8_t p = 0; p < PLANES; p++){
+        if ((fb->planes & (1 << p)) == 0){
+            continue;
+        }
+        if (fb->hires == 0){
+            for (uint8_t y = 0; y < LORES_HEIGTH; y++){
+                fb->rows[p][y][0] >>= 4;
+            }
+            continue;
+        }
         for (uint8_t y = 0; y < SCREEN_HEIGTH; y++){
-            draw_pixel(screen[x][y]);
+            fb->rows[p][y][1] = (fb->rows[p][y][1] >> 4) | (fb->rows[p][y][0] << 60);
+            fb->rows[p][y][0] >>= 4;
         }
     }
-    SDL_RenderPresent(sdl_renderer);
 }
 
-/* Set the value of the whole screen to black. */
-void clear_screen(){
-     for (uint8_t x = 0; x < SCREEN_WIDTH; x++){
+/**
+ * @brief Scroll the selected planes left by 4 pixels (00FC).
+ * 
+ * @param fb The framebuffer to scroll.
+ */
+void scroll_left(framebuffer* fb){
+    for (uint8_t p = 0; p < PLANES; p++){
+        if ((fb->planes & (1 << p)) == 0){
+            continue;
+        }
+        if (fb->hires == 0){
+            for (uint8_t y = 0; y < LORES_HEIGTH; y++){
+                fb->rows[p][y][0] <<= 4;
+            }
+            continue;
+        }
         for (uint8_t y = 0; y < SCREEN_HEIGTH; y++){
-            screen[x][y].couleur = PIXEL_BLACK;
+            fb->rows[p][y][0] = (fb->rows[p][y][0] << 4) | (fb->rows[p][y][1] >> 60);
+            fb->rows[p][y][1] <<= 4;
         }
     }
 }
 
-/* Initialize SDL screen, renderer and the SDL textures. */
+/* Initialize SDL screen, renderer and the SDL streaming texture. */
 void initialize_sdl(){
     sdl_window = NULL;
     sdl_renderer = NULL;
@@ -70,30 +332,19 @@ void initialize_sdl(){
         exit(EXIT_FAILURE);
     }
 
-    // Texture creation
-    SDL_Surface *sdl_surface[2];
-    sdl_surface[0] = SDL_CreateRGBSurface(SDL_SWSURFACE, PIXEL_SIZE, PIXEL_SIZE, 32, 0, 0, 0, 0);
-    sdl_surface[1] = SDL_CreateRGBSurface(SDL_SWSURFACE, PIXEL_SIZE, PIXEL_SIZE, 32, 0, 0, 0, 0);
-    
-    if (sdl_surface[0] == NULL || sdl_surface[1] == NULL){
-        fprintf(stderr, "Error in texture creation. See line %d :\n %s", __LINE__, SDL_GetError());
-        exit(EXIT_FAILURE);
-    }
-    SDL_FillRect(sdl_surface[0], NULL, SDL_MapRGB(sdl_surface[0]->format, 0x00, 0x00, 0x00));
-    SDL_FillRect(sdl_surface[1], NULL, SDL_MapRGB(sdl_surface[1]->format, 0xFF, 0xFF, 0xFF));
-
-    sdl_texture[0] = SDL_CreateTextureFromSurface(sdl_renderer, sdl_surface[0]);
-    sdl_texture[1] = SDL_CreateTextureFromSurface(sdl_renderer, sdl_surface[1]);
+    // Texture creation, one texel per CHIP-8 pixel, scaled by the renderer
+    sdl_texture = SDL_CreateTexture(sdl_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGTH);
 
-    if (sdl_texture[0] == NULL || sdl_texture[1] == NULL)
+    if (sdl_texture == NULL)
     {
         fprintf(stderr, "Error in texture creation. See line %d :\n %s", __LINE__, SDL_GetError());
         exit(EXIT_FAILURE);
     }
 
-    // Surface freeing
-    SDL_FreeSurface(sdl_surface[0]);
-    SDL_FreeSurface(sdl_surface[1]);
-
+    for (int byte = 0; byte < 256; byte++){
+        for (uint8_t x = 0; x < 8; x++){
+            expanded[byte][x] = (byte >> (7 - x)) & 1 ? COLOR_WHITE : COLOR_BLACK;
+        }
+    }
     SDL_RenderClear(sdl_renderer);
 }
@@ -10,52 +10,336 @@
  */
 #include <SDL2/SDL.h>
 #include <stdio.h>
+#include <string.h>
 #include "include/cpu.h"
 #include "include/display.h"
+#include "include/sound.h"
+#include "include/trace.h"
+#include "include/debugger.h"
+#include "include/capture.h"
+#include "include/telemetry.h"
+#include "include/timing.h"
+#include "include/rom.h"
+#include "include/launcher.h"
 
-void activate_sdl();
+#define HEADLESS_FRAMES 600 // 10s of emulated time
+
+void activate_sdl(Uint32 subsystems);
 void deactivate_sdl();
 void pause();
 uint8_t listen();
+void press_key(uint8_t key, uint8_t state);
+void release_keys();
+uint8_t run_frame(uint64_t frame);
+uint8_t run_timed_frame(uint64_t frame);
+void reload_rom(char* rom_name, uint8_t mode);
+void start_rom(int index);
 
-
+/* Set while the turbo key (TAB) is held, frames are not delayed. */
+uint8_t turbo = 0;
+/* Set by the screenshot key (F12), the screen is saved after the frame. */
+uint8_t screenshot = 0;
+/* Instructions executed and timer decrements done by the frame loops and the debugger, counted for the telemetry. */
+uint32_t executed = 0;
+uint32_t counted = 0;
+/* Set by the launcher key (ESC), the launcher is shown or hidden after the events. */
+uint8_t menu = 0;
+/* ROM picked in the launcher, started after the events. */
+int chosen = LAUNCHER_NONE;
 
 int main(int argc, char* argv[] ){
-    if (argc != 2){
+    char* rom_name = NULL;
+    char* wav_path = NULL;
+    char* trace_path = NULL;
+    char* capture_path = NULL;
+    char* stats_path = NULL;
+    uint8_t debug = 0;
+    uint8_t timed = 0;
+    uint8_t watch = 0;
+    uint8_t reload_mode = ROM_RESET;
+    long frames = HEADLESS_FRAMES;
+
+    for (int k = 1; k < argc; k++){
+        if (strcmp(argv[k], "--wav") == 0 && k + 1 < argc){
+            wav_path = argv[++k];
+        }
+        else if (strcmp(argv[k], "--trace") == 0 && k + 1 < argc){
+            trace_path = argv[++k];
+        }
+        else if (strcmp(argv[k], "--capture") == 0 && k + 1 < argc){
+            capture_path = argv[++k];
+        }
+        else if (strcmp(argv[k], "--stats") == 0 && k + 1 < argc){
+            stats_path = argv[++k];
+        }
+        else if (strcmp(argv[k], "--timing") == 0 && k + 1 < argc){
+            k++;
+            if (strcmp(argv[k], "vip") != 0 && strcmp(argv[k], "plain") != 0){
+                fprintf(stderr, "Unknown timing %s, expected plain or vip\n", argv[k]);
+                return EXIT_FAILURE;
+            }
+            timed = strcmp(argv[k], "vip") == 0;
+        }
+        else if (strcmp(argv[k], "--watch") == 0){
+            watch = 1;
+        }
+        else if (strcmp(argv[k], "--preserve") == 0){
+            reload_mode = ROM_PRESERVE;
+        }
+        else if (strcmp(argv[k], "--debug") == 0){
+            debug = 1;
+        }
+        else if (strcmp(argv[k], "--frames") == 0 && k + 1 < argc){
+            frames = strtol(argv[++k], NULL, 10);
+        }
+        else {
+            rom_name = argv[k];
+        }
+    }
+    // Without a ROM the emulator starts in the launcher, which needs the window
+    if (rom_name == NULL && wav_path != NULL){
         printf("You muste give a name.\n");
+        printf("Usage : %s [--wav <output.wav> [--frames <n>]] [--trace <file>] [--capture <file>] [--stats <file>] [--timing plain|vip] [--watch [--preserve]] [--debug] [<rom>]\n", argv[0]);
         return EXIT_SUCCESS;
     }
-    
-    activate_sdl();
-    initialize_sdl();
-    initialize_screen();
-    initialize();
-    load_game(argv[1]);
 
+    // Headless mode when the audio stream goes to a WAV file
+    if (wav_path != NULL){
+        activate_sdl(0);
+        if (open_wav(wav_path) == 0){
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        activate_sdl(SDL_INIT_VIDEO);
+        initialize_sdl();
+        initialize_sound();
+    }
+    if (load_digit(DIGIT_PATH) == 0){
+        fprintf(stderr, "Unable to load the digit file %s, the built-in digits are used.\n", DIGIT_PATH);
+    }
+    if (wav_path == NULL && launcher_open(LAUNCHER_DIRECTORY) == 0 && rom_name == NULL){
+        fprintf(stderr, "No ROM in %s, give the name of a ROM.\n", LAUNCHER_DIRECTORY);
+        return EXIT_FAILURE;
+    }
+    if (rom_name != NULL){
+        static uint8_t rom[ROM_MAX_SIZE];
+        uint32_t rom_size = read_rom(rom_name, rom);
+        if (rom_size == 0){
+            fprintf(stderr, "Unable to load the ROM.\n");
+            return EXIT_FAILURE;
+        }
+        apply_rom(rom, rom_size, ROM_RESET);
+        if (watch == 1 && rom_watch(rom_name) == 0){
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        initialize();
+        launcher_show();
+    }
+
+    if (trace_path != NULL){
+#ifdef TRACE
+        if (trace_open(trace_path) == 0){
+            return EXIT_FAILURE;
+        }
+#else
+        fprintf(stderr, "The emulator was built without tracing, use make TRACE=1.\n");
+#endif
+    }
+
+    if (capture_path != NULL && capture_open(capture_path) == 0){
+        return EXIT_FAILURE;
+    }
+    if (telemetry_open(stats_path) == 0){
+        return EXIT_FAILURE;
+    }
+
+    // The console needs the window loop, the headless mode runs a fixed number of frames
+    if (debug == 1 && wav_path == NULL){
+        debug_open();
+    }
+
+    uint64_t frame = 0;
     uint8_t keep_up = 1;
+    uint8_t playing = rom_name != NULL;
+    Uint64 frame_start = SDL_GetPerformanceCounter();
     do {
-        keep_up = listen();
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (frame > 0){
+            telemetry_record(TELEMETRY_FRAME, frame_start, now);
+        }
+        frame_start = now;
+
+        if (wav_path == NULL){
+            keep_up = listen();
+        }
+        if (debug_enabled()){
+            debug_poll();
+        }
+        // A ROM written since the last frame is applied before this one runs
+        if (watch == 1 && rom_changed()){
+            reload_rom(rom_name, reload_mode);
+        }
+        if (chosen != LAUNCHER_NONE){
+            start_rom(chosen);
+            chosen = LAUNCHER_NONE;
+            playing = 1;
+            watch = 0;
+        }
+        // ESC over a running game resumes it
+        else if (menu == 1 && launcher_shown() && playing == 1){
+            launcher_hide();
+        }
+        else if (menu == 1 && launcher_shown() == 0){
+            launcher_show();
+            release_keys();
+            mute_buzzer(frame * SAMPLES_PER_FRAME);
+        }
+        menu = 0;
+
+        sound_clock(frame * SAMPLES_PER_FRAME);
+
+        // The machine waits while the launcher is shown
+        if (launcher_shown()){
+            render_framebuffer(launcher_screen());
+        }
+        // The instrumented loop only runs while the debugger is paused or has something armed
+        else if (keep_up == 1){
+            now = SDL_GetPerformanceCounter();
+            if (debug_needed()){
+                keep_up = debug_frame(frame, timed);
+            }
+            else {
+                keep_up = timed ? run_timed_frame(frame) : run_frame(frame);
+            }
+            telemetry_record(TELEMETRY_EMULATE, now, SDL_GetPerformanceCounter());
+        }
+        if (wav_path == NULL && launcher_shown() == 0){
+            now = SDL_GetPerformanceCounter();
+            render_framebuffer(telemetry_overlay(&CPU.screen));
+            telemetry_record(TELEMETRY_PRESENT, now, SDL_GetPerformanceCounter());
+        }
+        capture_frame(&CPU.screen, frame);
+        if (screenshot == 1){
+            capture_screenshot(&CPU.screen, frame);
+            screenshot = 0;
+        }
+        frame++;
+        telemetry_frame(executed, counted);
+        executed = 0;
+        counted = 0;
 
-        // Interpret 4 opcode each 16ms
-        for (int actions = 0; actions<CPU_SPEED && keep_up == 1; actions++){
-            keep_up = interpret_opcode(get_opcode());
+        if (wav_path != NULL){
+            write_wav_frame();
+            if ((long) frame >= frames){
+                keep_up = 0;
+            }
+        }
+        else if (turbo == 0){
+            now = SDL_GetPerformanceCounter();
+            SDL_Delay(FPS);
+            // Only the time slept past the delay is recorded
+            telemetry_record(TELEMETRY_SLEEP, now + FPS * SDL_GetPerformanceFrequency() / 1000, SDL_GetPerformanceCounter());
         }
-        update_screen();
-        time_count();
-        SDL_Delay(FPS);
     } while (keep_up == 1);
-    pause();
+    // The thumbnail thread runs a machine too, it is stopped before the trace is closed
+    launcher_close();
+    trace_close();
+    capture_close();
+    telemetry_close();
+    rom_unwatch();
+
+    if (wav_path == NULL){
+        pause();
+    }
 
     return EXIT_SUCCESS;
 }
 
+/**
+ * @brief Interpret 4 opcode each 16ms then count the time, buzzer and pattern edges are stamped with the emulated time of the opcode.
+ * 
+ * @param frame Number of the frame.
+ * @return uint8_t 0 to stop the emulator, 1 otherwise.
+ */
+uint8_t run_frame(uint64_t frame){
+    uint8_t keep_up = 1;
+
+    for (int actions = 0; actions<CPU_SPEED && keep_up == 1; actions++){
+        keep_up = step();
+        executed++;
+        update_buzzer(frame * SAMPLES_PER_FRAME + (actions + 1) * SAMPLES_PER_FRAME / CPU_SPEED);
+    }
+    time_count();
+    counted++;
+    update_buzzer((frame + 1) * SAMPLES_PER_FRAME);
+    return keep_up;
+}
+
+/**
+ * @brief Interpret opcodes until the VIP cycle budget of the frame is spent then count the time, buzzer and pattern
+ * edges are stamped with the cycles spent. Separate from run_frame() so that the plain mode pays nothing for the timing.
+ * 
+ * @param frame Number of the frame.
+ * @return uint8_t 0 to stop the emulator, 1 otherwise.
+ */
+uint8_t run_timed_frame(uint64_t frame){
+    uint8_t keep_up = 1;
+
+    while (keep_up == 1 && timing_frame_done() == 0){
+        keep_up = timed_step();
+        executed++;
+        update_buzzer(frame * SAMPLES_PER_FRAME + timing_cycles() * SAMPLES_PER_FRAME / TIMING_BUDGET);
+    }
+    timing_next_frame();
+    time_count();
+    counted++;
+    update_buzzer((frame + 1) * SAMPLES_PER_FRAME);
+    return keep_up;
+}
+
+/**
+ * @brief Apply the new content of the ROM file to the running machine, the window and the audio device are kept.
+ * 
+ * @param rom_name Path of the ROM.
+ * @param mode ROM_RESET or ROM_PRESERVE.
+ */
+void reload_rom(char* rom_name, uint8_t mode){
+    static uint8_t rom[ROM_MAX_SIZE];
+    uint32_t size = read_rom(rom_name, rom);
+
+    // An empty file is a save in progress, the next write triggers another reload
+    if (size == 0){
+        return;
+    }
+    printf("Reloaded %s, %u bytes changed\n", rom_name, apply_rom(rom, size, mode));
+    timing_reset();
+}
+
+/**
+ * @brief Start a ROM of the launcher on the machine of the emulator : the ROM is copied from memory,
+ * the window, the renderer and the audio device are kept.
+ * 
+ * @param index Index of the ROM in the launcher.
+ */
+void start_rom(int index){
+    launcher_rom* rom = launcher_get(index);
+
+    apply_rom(rom->data, rom->size, ROM_RESET);
+    timing_reset();
+    launcher_hide();
+}
+
 /**
  * @brief Function that launches SDL.
  * 
+ * @param subsystems SDL subsystems to initialize, 0 in headless mode.
  */
-void activate_sdl(){
+void activate_sdl(Uint32 subsystems){
     atexit(deactivate_sdl);
-    if (SDL_Init(SDL_INIT_VIDEO) == -1){
+    if (SDL_Init(subsystems) == -1){
         fprintf(stderr, "Unable to launch SDL :\n %s", SDL_GetError());
         exit(EXIT_FAILURE);
     }
@@ -63,9 +347,11 @@ void activate_sdl(){
 
 /* Function that stops SDL and free allocated texture elements. */
 void deactivate_sdl(){
-    // Freeing textures
-    SDL_DestroyTexture(sdl_texture[0]);
-    SDL_DestroyTexture(sdl_texture[1]);
+    // Closing audio device and WAV file
+    close_sound();
+
+    // Freeing texture
+    SDL_DestroyTexture(sdl_texture);
 
     // Freeing renderer and window
     SDL_DestroyRenderer(sdl_renderer);
@@ -93,6 +379,22 @@ void pause(){
     } while (keep == 1);
 }
 
+/* Pass a key to the machine, unless the launcher is shown : the game is paused and the keys browse the menu. */
+void press_key(uint8_t key, uint8_t state){
+    if (launcher_shown() == 0){
+        set_key(key, state);
+    }
+}
+
+/* Release the held keys of the machine, so that none stays pressed behind the launcher. */
+void release_keys(){
+    for (uint8_t key = 0; key < NB_KEYS; key++){
+        if (CPU.keyboard[key] == KEY_PRESSED){
+            set_key(key, KEY_UNPRESSED);
+        }
+    }
+}
+
 uint8_t listen(){
     uint8_t keep_up = 1;
 
@@ -102,43 +404,56 @@ uint8_t listen(){
             case SDL_QUIT: {keep_up = 0; break;}
             case SDL_KEYDOWN:
                 switch(sdl_event.key.keysym.sym){
-                    case SDLK_0: { CPU.keyboard[0x0] = KEY_PRESSED; break;}
-                    case SDLK_1: { CPU.keyboard[0x1] = KEY_PRESSED; break;}
-                    case SDLK_2: { CPU.keyboard[0x2] = KEY_PRESSED; break;}
-                    case SDLK_3: { CPU.keyboard[0x3] = KEY_PRESSED; break;}
-                    case SDLK_4: { CPU.keyboard[0x4] = KEY_PRESSED; break;}
-                    case SDLK_5: { CPU.keyboard[0x5] = KEY_PRESSED; break;}
-                    case SDLK_6: { CPU.keyboard[0x6] = KEY_PRESSED; break;}
-                    case SDLK_7: { CPU.keyboard[0x7] = KEY_PRESSED; break;}
-                    case SDLK_8: { CPU.keyboard[0x8] = KEY_PRESSED; break;}
-                    case SDLK_9: { CPU.keyboard[0x9] = KEY_PRESSED; break;}
-                    case SDLK_a: { CPU.keyboard[0xa] = KEY_PRESSED; break;}
-                    case SDLK_b: { CPU.keyboard[0xb] = KEY_PRESSED; break;}
-                    case SDLK_c: { CPU.keyboard[0xc] = KEY_PRESSED; break;}
-                    case SDLK_d: { CPU.keyboard[0xd] = KEY_PRESSED; break;}
-                    case SDLK_e: { CPU.keyboard[0xe] = KEY_PRESSED; break;}
-                    case SDLK_f: { CPU.keyboard[0xf] = KEY_PRESSED; break;}
+                    case SDLK_0: { press_key(0x0, KEY_PRESSED); break;}
+                    case SDLK_1: { press_key(0x1, KEY_PRESSED); break;}
+                    case SDLK_2: { press_key(0x2, KEY_PRESSED); break;}
+                    case SDLK_3: { press_key(0x3, KEY_PRESSED); break;}
+                    case SDLK_4: { press_key(0x4, KEY_PRESSED); break;}
+                    case SDLK_5: { press_key(0x5, KEY_PRESSED); break;}
+                    case SDLK_6: { press_key(0x6, KEY_PRESSED); break;}
+                    case SDLK_7: { press_key(0x7, KEY_PRESSED); break;}
+                    case SDLK_8: { press_key(0x8, KEY_PRESSED); break;}
+                    case SDLK_9: { press_key(0x9, KEY_PRESSED); break;}
+                    case SDLK_a: { press_key(0xa, KEY_PRESSED); break;}
+                    case SDLK_b: { press_key(0xb, KEY_PRESSED); break;}
+                    case SDLK_c: { press_key(0xc, KEY_PRESSED); break;}
+                    case SDLK_d: { press_key(0xd, KEY_PRESSED); break;}
+                    case SDLK_e: { press_key(0xe, KEY_PRESSED); break;}
+                    case SDLK_f: { press_key(0xf, KEY_PRESSED); break;}
+                    case SDLK_TAB: { turbo = 1; break;}
+                    case SDLK_F5: { debug_command("c"); break;}
+                    case SDLK_F6: { debug_command("s"); break;}
+                    case SDLK_F9: { debug_command("p"); break;}
+                    case SDLK_F3: { telemetry_toggle(); break;}
+                    case SDLK_F12: { screenshot = 1; break;}
+                    case SDLK_ESCAPE: { menu = 1; break;}
+                    case SDLK_UP:
+                    case SDLK_DOWN:
+                    case SDLK_LEFT:
+                    case SDLK_RIGHT:
+                    case SDLK_RETURN: { chosen = launcher_key(sdl_event.key.keysym.sym); break;}
                     default: {break;}
                 }
                 break;
             case SDL_KEYUP:
                 switch(sdl_event.key.keysym.sym){
-                    case SDLK_0: { CPU.keyboard[0x0] = KEY_UNPRESSED; break;}
-                    case SDLK_1: { CPU.keyboard[0x1] = KEY_UNPRESSED; break;}
-                    case SDLK_2: { CPU.keyboard[0x2] = KEY_UNPRESSED; break;}
-                    case SDLK_3: { CPU.keyboard[0x3] = KEY_UNPRESSED; break;}
-                    case SDLK_4: { CPU.keyboard[0x4] = KEY_UNPRESSED; break;}
-                    case SDLK_5: { CPU.keyboard[0x5] = KEY_UNPRESSED; break;}
-                    case SDLK_6: { CPU.keyboard[0x6] = KEY_UNPRESSED; break;}
-                    case SDLK_7: { CPU.keyboard[0x7] = KEY_UNPRESSED; break;}
-                    case SDLK_8: { CPU.keyboard[0x8] = KEY_UNPRESSED; break;}
-                    case SDLK_9: { CPU.keyboard[0x9] = KEY_UNPRESSED; break;}
-                    case SDLK_a: { CPU.keyboard[0xa] = KEY_UNPRESSED; break;}
-                    case SDLK_b: { CPU.keyboard[0xb] = KEY_UNPRESSED; break;}
-                    case SDLK_c: { CPU.keyboard[0xc] = KEY_UNPRESSED; break;}
-                    case SDLK_d: { CPU.keyboard[0xd] = KEY_UNPRESSED; break;}
-                    case SDLK_e: { CPU.keyboard[0xe] = KEY_UNPRESSED; break;}
-                    case SDLK_f: { CPU.keyboard[0xf] = KEY_UNPRESSED; break;}
+                    case SDLK_0: { press_key(0x0, KEY_UNPRESSED); break;}
+                    case SDLK_1: { press_key(0x1, KEY_UNPRESSED); break;}
+                    case SDLK_2: { press_key(0x2, KEY_UNPRESSED); break;}
+                    case SDLK_3: { press_key(0x3, KEY_UNPRESSED); break;}
+                    case SDLK_4: { press_key(0x4, KEY_UNPRESSED); break;}
+                    case SDLK_5: { press_key(0x5, KEY_UNPRESSED); break;}
+                    case SDLK_6: { press_key(0x6, KEY_UNPRESSED); break;}
+                    case SDLK_7: { press_key(0x7, KEY_UNPRESSED); break;}
+                    case SDLK_8: { press_key(0x8, KEY_UNPRESSED); break;}
+                    case SDLK_9: { press_key(0x9, KEY_UNPRESSED); break;}
+                    case SDLK_a: { press_key(0xa, KEY_UNPRESSED); break;}
+                    case SDLK_b: { press_key(0xb, KEY_UNPRESSED); break;}
+                    case SDLK_c: { press_key(0xc, KEY_UNPRESSED); break;}
+                    case SDLK_d: { press_key(0xd, KEY_UNPRESSED); break;}
+                    case SDLK_e: { press_key(0xe, KEY_UNPRESSED); break;}
+                    case SDLK_f: { press_key(0xf, KEY_UNPRESSED); break;}
+                    case SDLK_TAB: { turbo = 0; break;}
                     default: {break;}
                 }
                 break;
@@ -0,0 +1,433 @@
+/**
+ * @file explorer.c
+ * @author Xavier Monard
+ * @brief Breadth first exploration of the states reachable by a ROM : from every snapshot of
+ * the frontier, each key is held a few frames then released. States already seen are dropped
+ * by a hash of their registers, memory and framebuffer. The frontier is split between threads.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/explorer.h"
+
+/**
+ * @brief Exploration of one thread, during one level.
+ *
+ * @param work The machine run by the thread.
+ * @param arenas Snapshots of the even and odd levels.
+ * @param next States of the next level found by the thread.
+ * @param count Number of states in next.
+ * @param capacity Allocated size of next.
+ * @param expanded Children computed.
+ * @param reached 1 if the goal was reached during the current action.
+ * @param coverage Executed addresses, one bit each.
+ */
+typedef struct {
+    cpu work;
+    arena arenas[2];
+    uint8_t** next;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t expanded;
+    uint8_t reached;
+    uint8_t coverage[MEMORY_SIZE / 8];
+} worker;
+
+static cpu start;
+static size_t snapshot_size;
+static size_t saved_memory = MEMORY_SIZE;
+static uint32_t frames = EXPLORER_FRAMES;
+static uint32_t max_states = EXPLORER_STATES;
+static state_set visited;
+static trail* trails = NULL;
+static SDL_atomic_t state_count;
+static SDL_atomic_t next_index;
+static SDL_atomic_t found;
+static uint8_t** frontier = NULL;
+static uint32_t frontier_count = 0;
+static uint32_t depth = 0;
+static int goal_pc = -1;
+static int goal_address = -1;
+static uint8_t goal_value = 0;
+static arena_block* pool = NULL;
+static SDL_mutex* pool_lock = NULL;
+static SDL_atomic_t block_count;
+
+/* Snapshots start with the trail index, then the machine after its memory (MACHINE_OFFSET), then the saved memory. */
+
+/**
+ * @brief Allocate a snapshot in an arena.
+ *
+ * @param a The arena.
+ * @return uint8_t* The snapshot.
+ */
+static uint8_t* arena_alloc(arena* a){
+    if (a->blocks == NULL || a->blocks->used + snapshot_size > ARENA_BLOCK_SIZE - sizeof(arena_block)){
+        arena_block* block;
+        SDL_LockMutex(pool_lock);
+        block = pool;
+        if (block != NULL){
+            pool = block->next;
+        }
+        SDL_UnlockMutex(pool_lock);
+        if (block == NULL){
+            block = malloc(ARENA_BLOCK_SIZE);
+            if (block == NULL){
+                fprintf(stderr, "Unable to allocate snapshots.\n");
+                exit(EXIT_FAILURE);
+            }
+            SDL_AtomicAdd(&block_count, 1);
+        }
+        block->used = 0;
+        block->next = a->blocks;
+        a->blocks = block;
+    }
+    uint8_t* snapshot = a->blocks->data + a->blocks->used;
+    a->blocks->used += snapshot_size;
+    return snapshot;
+}
+
+/* Give the blocks of an arena back to the pool. */
+static void arena_release(arena* a){
+    SDL_LockMutex(pool_lock);
+    while (a->blocks != NULL){
+        arena_block* block = a->blocks;
+        a->blocks = block->next;
+        block->next = pool;
+        pool = block;
+    }
+    SDL_UnlockMutex(pool_lock);
+}
+
+/* Hash of a snapshot, its parent trail excluded, never 0. */
+static uint64_t hash_snapshot(const uint8_t* snapshot){
+    uint64_t hash = hash_bytes(HASH_SEED, snapshot + sizeof(uint32_t), snapshot_size - sizeof(uint32_t));
+
+    hash ^= hash >> 29;
+    return hash == 0 ? 1 : hash;
+}
+
+/**
+ * @brief Add a hash to the set of visited states.
+ *
+ * @param hash The hash of the state.
+ * @return uint8_t 1 if the state is new.
+ */
+static uint8_t visit(uint64_t hash){
+    uint32_t shard = hash >> 56;
+    uint64_t* slots = visited.slots + (size_t) shard * visited.shard_size;
+    uint32_t slot = hash & (visited.shard_size - 1);
+    uint8_t added = 0;
+
+    SDL_LockMutex(visited.locks[shard]);
+    for (uint32_t probe = 0; probe < visited.shard_size; probe++){
+        uint64_t* s = &slots[(slot + probe) & (visited.shard_size - 1)];
+        if (*s == hash){
+            break;
+        }
+        if (*s == 0){
+            *s = hash;
+            added = 1;
+            break;
+        }
+    }
+    SDL_UnlockMutex(visited.locks[shard]);
+    return added;
+}
+
+/* Copy the machine of the thread in a snapshot. The padding up to snapshot_size is hashed too, it is cleared
+   so that equal machines hash alike whatever the arena block held before. */
+static void save(uint8_t* snapshot, uint32_t index){
+    size_t end = sizeof(index) + MACHINE_SIZE + saved_memory;
+
+    memcpy(snapshot, &index, sizeof(index));
+    memcpy(snapshot + sizeof(index), (uint8_t*) &CPU + MACHINE_OFFSET, MACHINE_SIZE);
+    memcpy(snapshot + sizeof(index) + MACHINE_SIZE, CPU.ram, saved_memory);
+    memset(snapshot + end, 0, snapshot_size - end);
+}
+
+/* Restore the machine of the thread from a snapshot. */
+static uint32_t restore(const uint8_t* snapshot){
+    uint32_t index;
+    memcpy(&index, snapshot, sizeof(index));
+    memcpy((uint8_t*) &CPU + MACHINE_OFFSET, snapshot + sizeof(index), MACHINE_SIZE);
+    memcpy(CPU.ram, snapshot + sizeof(index) + MACHINE_SIZE, saved_memory);
+    return index;
+}
+
+/* The goal given on the command line is reached by the machine of the thread. */
+static uint8_t goal_reached(){
+    return (goal_pc >= 0 && CPU.PC == goal_pc) || (goal_address >= 0 && CPU.ram[goal_address] == goal_value);
+}
+
+/**
+ * @brief Run frames on the machine of the thread, as the emulator does, checking the goal after each instruction.
+ *
+ * @param w The worker, for the coverage.
+ * @param count Number of frames.
+ * @return uint8_t 0 if the game exited (00FD).
+ */
+static uint8_t run_frames(worker* w, uint32_t count){
+    for (uint32_t frame = 0; frame < count; frame++){
+        for (int actions = 0; actions < CPU_SPEED; actions++){
+            w->coverage[CPU.PC >> 3] |= 1 << (CPU.PC & 7);
+            if (step() == 0){
+                return 0;
+            }
+            w->reached |= goal_reached();
+        }
+        time_count();
+    }
+    return 1;
+}
+
+/**
+ * @brief Expand states of the frontier until it is exhausted : every action from every state.
+ *
+ * @param data The worker of the thread.
+ */
+static int expand(void* data){
+    worker* w = data;
+    arena* a = &w->arenas[(depth + 1) % 2];
+
+    cpu_context = &w->work;
+    for (;;){
+        int index = SDL_AtomicAdd(&next_index, 1);
+        if (index >= (int) frontier_count || SDL_AtomicGet(&found) != 0){
+            break;
+        }
+        for (uint8_t k = 0; k < ACTIONS; k++){
+            uint8_t action = k < NB_KEYS ? k : NO_KEY;
+            uint32_t parent = restore(frontier[index]);
+            uint8_t alive;
+
+            w->reached = 0;
+            if (action != NO_KEY){
+                set_key(action, KEY_PRESSED);
+            }
+            alive = run_frames(w, frames);
+            if (action != NO_KEY){
+                set_key(action, KEY_UNPRESSED);
+            }
+            alive = alive && run_frames(w, frames);
+            w->expanded++;
+
+            uint8_t* child = arena_alloc(a);
+            save(child, 0);
+            if (visit(hash_snapshot(child)) == 0){
+                // Already seen, the snapshot is reused by the next child
+                a->blocks->used -= snapshot_size;
+                continue;
+            }
+            int id = SDL_AtomicAdd(&state_count, 1);
+            if (id >= (int) max_states){
+                a->blocks->used -= snapshot_size;
+                continue;
+            }
+            trails[id].parent = parent;
+            trails[id].action = action;
+            memcpy(child, &id, sizeof(uint32_t));
+
+            if (w->reached){
+                SDL_AtomicCAS(&found, 0, id + 1);
+            }
+            if (alive == 0){
+                a->blocks->used -= snapshot_size;
+                continue;
+            }
+            if (w->count == w->capacity){
+                w->capacity = w->capacity ? 2 * w->capacity : 1024;
+                w->next = realloc(w->next, w->capacity * sizeof(uint8_t*));
+            }
+            w->next[w->count++] = child;
+        }
+    }
+    return 0;
+}
+
+/* Print the actions leading to a state, '.' being no key. */
+static void print_path(uint32_t id){
+    char path[EXPLORER_DEPTH * 64];
+    uint32_t length = 0;
+
+    while (id != 0 && length < sizeof(path) - 1){
+        path[length++] = movie_key(trails[id].action);
+        id = trails[id].parent;
+    }
+    printf("Inputs (each held %u frames then released %u frames) : ", frames, frames);
+    while (length > 0){
+        putchar(path[--length]);
+    }
+    putchar('\n');
+}
+
+int main(int argc, char* argv[]){
+    char* rom_name = NULL;
+    uint32_t max_depth = EXPLORER_DEPTH;
+    int threads = SDL_GetCPUCount();
+
+    for (int k = 1; k < argc; k++){
+        if (strcmp(argv[k], "--depth") == 0 && k + 1 < argc){
+            max_depth = strtoul(argv[++k], NULL, 10);
+        }
+        else if (strcmp(argv[k], "--states") == 0 && k + 1 < argc){
+            max_states = strtoul(argv[++k], NULL, 10);
+        }
+        else if (strcmp(argv[k], "--frames") == 0 && k + 1 < argc){
+            frames = strtoul(argv[++k], NULL, 10);
+        }
+        else if (strcmp(argv[k], "--threads") == 0 && k + 1 < argc){
+            threads = atoi(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--memory") == 0 && k + 1 < argc){
+            saved_memory = strtoul(argv[++k], NULL, 0);
+        }
+        else if (strcmp(argv[k], "--goal-pc") == 0 && k + 1 < argc){
+            goal_pc = strtol(argv[++k], NULL, 16) & 0xFFFF;
+        }
+        else if (strcmp(argv[k], "--goal-ram") == 0 && k + 2 < argc){
+            goal_address = strtol(argv[++k], NULL, 16) & 0xFFFF;
+            goal_value = strtol(argv[++k], NULL, 16);
+        }
+        else {
+            rom_name = argv[k];
+        }
+    }
+    if (rom_name == NULL || threads < 1 || max_states < 2 || saved_memory > MEMORY_SIZE){
+        printf("You must give a rom.\n");
+        printf("Usage : %s [--depth <n>] [--states <n>] [--frames <n>] [--threads <n>] [--memory <bytes>]\n", argv[0]);
+        printf("        [--goal-pc <hex address>] [--goal-ram <hex address> <hex value>] <rom>\n");
+        return EXIT_FAILURE;
+    }
+
+    initialize();
+    load_game(rom_name);
+    // Games fitting in 4KB only save their first 4KB, unless --memory says otherwise
+    if (saved_memory == MEMORY_SIZE && CPU.ram[SMALL_MEMORY] == 0 && memcmp(&CPU.ram[SMALL_MEMORY], &CPU.ram[SMALL_MEMORY + 1], MEMORY_SIZE - SMALL_MEMORY - 1) == 0){
+        saved_memory = SMALL_MEMORY;
+    }
+    start = CPU;
+    snapshot_size = (sizeof(uint32_t) + MACHINE_SIZE + saved_memory + 7) & ~(size_t) 7;
+
+    // Hash set at most half full
+    uint32_t slots = 1024;
+    while (slots < 2 * max_states){
+        slots *= 2;
+    }
+    visited.shard_size = slots / HASH_SHARDS > 0 ? slots / HASH_SHARDS : 1;
+    visited.slots = calloc((size_t) visited.shard_size * HASH_SHARDS, sizeof(uint64_t));
+    for (int k = 0; k < HASH_SHARDS; k++){
+        visited.locks[k] = SDL_CreateMutex();
+    }
+    trails = calloc(max_states, sizeof(trail));
+    pool_lock = SDL_CreateMutex();
+
+    worker* workers = calloc(threads, sizeof(worker));
+    SDL_Thread** handles = malloc(threads * sizeof(SDL_Thread*));
+    if (visited.slots == NULL || trails == NULL || workers == NULL || handles == NULL){
+        fprintf(stderr, "Unable to allocate the explorer.\n");
+        return EXIT_FAILURE;
+    }
+    for (int k = 0; k < threads; k++){
+        workers[k].work = start;
+    }
+
+    // The initial state is state 0, its own parent
+    cpu_context = &workers[0].work;
+    uint8_t* root = arena_alloc(&workers[0].arenas[0]);
+    save(root, 0);
+    visit(hash_snapshot(root));
+    SDL_AtomicSet(&state_count, 1);
+    frontier = malloc(sizeof(uint8_t*));
+    frontier[0] = root;
+    frontier_count = 1;
+
+    Uint64 timer = SDL_GetPerformanceCounter();
+    uint64_t expanded = 0;
+    for (depth = 0; depth < max_depth && frontier_count > 0 && SDL_AtomicGet(&found) == 0
+         && SDL_AtomicGet(&state_count) < (int) max_states; depth++){
+        SDL_AtomicSet(&next_index, 0);
+        for (int k = 0; k < threads; k++){
+            workers[k].count = 0;
+            handles[k] = SDL_CreateThread(expand, "explorer", &workers[k]);
+        }
+        for (int k = 0; k < threads; k++){
+            SDL_WaitThread(handles[k], NULL);
+        }
+
+        // The expanded level is released, the next one becomes the frontier
+        frontier_count = 0;
+        for (int k = 0; k < threads; k++){
+            arena_release(&workers[k].arenas[depth % 2]);
+            frontier_count += workers[k].count;
+        }
+        frontier = realloc(frontier, (frontier_count + 1) * sizeof(uint8_t*));
+        uint32_t n = 0;
+        for (int k = 0; k < threads; k++){
+            memcpy(frontier + n, workers[k].next, workers[k].count * sizeof(uint8_t*));
+            n += workers[k].count;
+        }
+
+        expanded = 0;
+        for (int k = 0; k < threads; k++){
+            expanded += workers[k].expanded;
+        }
+        double seconds = (double) (SDL_GetPerformanceCounter() - timer) / SDL_GetPerformanceFrequency();
+        int visited_count = SDL_AtomicGet(&state_count) < (int) max_states ? SDL_AtomicGet(&state_count) : (int) max_states;
+        printf("depth %2u : %8u new states, %9d visited, %10.0f new states/s, %10.0f children/s\n", depth + 1,
+               frontier_count, visited_count, visited_count / seconds, expanded / seconds);
+    }
+
+    // Results
+    uint32_t covered = 0;
+    for (uint32_t k = 0; k < MEMORY_SIZE / 8; k++){
+        uint8_t bits = 0;
+        for (int t = 0; t < threads; t++){
+            bits |= workers[t].coverage[k];
+        }
+        while (bits){
+            covered += bits & 1;
+            bits >>= 1;
+        }
+    }
+    uint32_t states = SDL_AtomicGet(&state_count) < (int) max_states ? (uint32_t) SDL_AtomicGet(&state_count) : max_states;
+    double arenas = (double) SDL_AtomicGet(&block_count) * ARENA_BLOCK_SIZE;
+    double tables = (double) visited.shard_size * HASH_SHARDS * sizeof(uint64_t) + (double) max_states * sizeof(trail);
+    printf("%u states, %lu children in %.2fs with %d threads, %u executed addresses\n", states, (unsigned long) expanded,
+           (double) (SDL_GetPerformanceCounter() - timer) / SDL_GetPerformanceFrequency(), threads, covered);
+    printf("snapshot %lu bytes (%lu bytes of memory), %.1f MB of snapshots, %.1f MB of tables, %.0f bytes per visited state\n",
+           (unsigned long) snapshot_size, (unsigned long) saved_memory, arenas / 1e6, tables / 1e6, (arenas + tables) / states);
+    if (SDL_AtomicGet(&found) != 0){
+        print_path(SDL_AtomicGet(&found) - 1);
+    }
+    else if (goal_pc >= 0 || goal_address >= 0){
+        printf("Goal not reached.\n");
+    }
+    int status = SDL_AtomicGet(&found) != 0 || (goal_pc < 0 && goal_address < 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    for (int k = 0; k < threads; k++){
+        arena_release(&workers[k].arenas[0]);
+        arena_release(&workers[k].arenas[1]);
+        free(workers[k].next);
+    }
+    while (pool != NULL){
+        arena_block* block = pool;
+        pool = block->next;
+        free(block);
+    }
+    for (int k = 0; k < HASH_SHARDS; k++){
+        SDL_DestroyMutex(visited.locks[k]);
+    }
+    SDL_DestroyMutex(pool_lock);
+    free(visited.slots);
+    free(trails);
+    free(frontier);
+    free(handles);
+    free(workers);
+    return status;
+}
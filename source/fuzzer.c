@@ -0,0 +1,374 @@
+/**
+ * @file fuzzer.c
+ * @author Xavier Monard
+ * @brief Coverage guided fuzzer of the core. An input is a ROM and the key held during each
+ * frame. Inputs reaching new PC or opcode edges join the corpus, and are mutated to make the next
+ * ones. The machine is reset in place between executions, only the memory pages written by the
+ * previous input are restored, and nothing is allocated once the fuzzing started.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include "include/fuzzer.h"
+#include "include/display.h"
+
+/* Reset restores the machine after its memory (MACHINE_OFFSET), then the dirty pages of memory. */
+#define PAGES (MEMORY_SIZE / PAGE_SIZE)
+
+static cpu base;
+static cpu work;
+static uint8_t dirty[PAGES];
+static uint8_t dirty_list[PAGES];
+static uint32_t dirty_count = 0;
+static uint8_t pc_edges[FUZZ_MAP_SIZE];
+static uint8_t opcode_edges[FUZZ_MAP_SIZE];
+static uint32_t pc_edge_count = 0;
+static uint32_t opcode_edge_count = 0;
+static fault_record faults[FUZZ_FAULTS];
+static uint32_t fault_count = 0;
+static uint8_t* corpus = NULL;
+static uint32_t corpus_count = 0;
+static uint32_t rom_size = 0;
+static uint32_t frames = FUZZ_FRAMES;
+static size_t input_size;
+static uint32_t rng = RNG_SEED;
+static char* out_directory = NULL;
+
+/* Random number below limit. */
+static uint32_t draw(uint32_t limit){
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng % limit;
+}
+
+/* Remember that a page of memory must be restored. */
+static void touch(uint16_t address){
+    uint8_t page = address / PAGE_SIZE;
+    if (dirty[page] == 0){
+        dirty[page] = 1;
+        dirty_list[dirty_count++] = page;
+    }
+}
+
+/* Put the machine back in its state after loading, the input is not written. */
+static void reset(){
+    memcpy((uint8_t*) &work + MACHINE_OFFSET, (uint8_t*) &base + MACHINE_OFFSET, MACHINE_SIZE);
+    for (uint32_t k = 0; k < dirty_count; k++){
+        memcpy(&work.ram[dirty_list[k] * PAGE_SIZE], &base.ram[dirty_list[k] * PAGE_SIZE], PAGE_SIZE);
+        dirty[dirty_list[k]] = 0;
+    }
+    dirty_count = 0;
+}
+
+/**
+ * @brief Identify an instruction without its operands, so that edges between instructions do not depend on them.
+ *
+ * @param opcode The instruction.
+ * @return uint16_t Its leftmost 4 bits, followed by the bits telling apart the instructions sharing them.
+ */
+static uint16_t instruction_kind(uint16_t opcode){
+    switch (opcode >> 12){
+        case 0x0:
+        case 0xE:
+        case 0xF:
+            return opcode & 0xF0FF;
+        case 0x5:
+        case 0x8:
+            return opcode & 0xF00F;
+        default:
+            return opcode & 0xF000;
+    }
+}
+
+/**
+ * @brief Record a fault, and save its input in the output directory the first time this fault is raised by this kind of instruction.
+ *
+ * @param input The input which raised it.
+ * @param PC Address of the instruction.
+ * @param opcode The instruction.
+ * @param execution Number of the execution.
+ */
+static void record_fault(const uint8_t* input, uint16_t PC, uint16_t opcode, uint64_t execution){
+    for (uint32_t k = 0; k < fault_count; k++){
+        if (instruction_kind(faults[k].opcode) == instruction_kind(opcode) && faults[k].kind == work.fault){
+            return;
+        }
+    }
+    if (fault_count == FUZZ_FAULTS){
+        return;
+    }
+    faults[fault_count].PC = PC;
+    faults[fault_count].opcode = opcode;
+    faults[fault_count].kind = work.fault;
+    faults[fault_count].execution = execution;
+    fault_count++;
+
+    if (out_directory != NULL){
+        char name[FILENAME_MAX];
+        FILE* file;
+
+        snprintf(name, sizeof(name), "%s/fault-%04X-%X.ch8", out_directory, PC, work.fault);
+        file = fopen(name, "wb");
+        if (file != NULL){
+            fwrite(input, 1, rom_size, file);
+            fclose(file);
+        }
+        snprintf(name, sizeof(name), "%s/fault-%04X-%X.keys", out_directory, PC, work.fault);
+        file = fopen(name, "w");
+        if (file != NULL){
+            write_movie(file, input + rom_size, frames);
+            fclose(file);
+        }
+    }
+}
+
+/**
+ * @brief Run an input from the reset machine.
+ *
+ * @param input The ROM bytes followed by the key of each frame.
+ * @param execution Number of the execution.
+ * @return uint32_t Number of new edges.
+ */
+static uint32_t execute(const uint8_t* input, uint64_t execution){
+    const uint8_t* keys = input + rom_size;
+    uint32_t fresh = 0;
+    uint16_t previous_pc = 0;
+    uint16_t previous_kind = 0;
+    uint8_t held = NO_KEY;
+
+    reset();
+    memcpy(&work.ram[READ_AREA], input, rom_size);
+    for (uint32_t k = READ_AREA; k < READ_AREA + rom_size; k += PAGE_SIZE){
+        touch(k);
+    }
+    touch(READ_AREA + rom_size - 1);
+
+    for (uint32_t f = 0; f < frames; f++){
+        if (keys[f] != held){
+            if (held != NO_KEY){
+                set_key(held, KEY_UNPRESSED);
+            }
+            held = keys[f];
+            if (held != NO_KEY){
+                set_key(held, KEY_PRESSED);
+            }
+        }
+        for (int actions = 0; actions < CPU_SPEED; actions++){
+            uint16_t PC = work.PC;
+            uint16_t opcode = get_opcode();
+            uint16_t kind = instruction_kind(opcode);
+            uint32_t edge = (PC ^ previous_pc) & (FUZZ_MAP_SIZE - 1);
+
+            if (pc_edges[edge] == 0){
+                pc_edges[edge] = 1;
+                pc_edge_count++;
+                fresh++;
+            }
+            edge = ((previous_kind << 4) ^ kind) & (FUZZ_MAP_SIZE - 1);
+            if (opcode_edges[edge] == 0){
+                opcode_edges[edge] = 1;
+                opcode_edge_count++;
+                fresh++;
+            }
+            previous_pc = PC >> 1;
+            previous_kind = kind;
+
+            // Instructions writing memory from I
+            if ((opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055 || (opcode & 0xF00F) == 0x5002){
+                touch(work.I);
+                touch(work.I + REGISTER_NUMBER - 1);
+            }
+            uint8_t keep_up = interpret_opcode(opcode);
+            if (work.fault != 0){
+                record_fault(input, PC, opcode, execution);
+                return fresh;
+            }
+            if (keep_up == 0){
+                return fresh;
+            }
+        }
+        time_count();
+    }
+    return fresh;
+}
+
+/**
+ * @brief Make an input from an input of the corpus.
+ *
+ * @param input Receives the new input.
+ */
+static void mutate(uint8_t* input){
+    memcpy(input, corpus + draw(corpus_count) * input_size, input_size);
+
+    for (uint32_t n = 1 + draw(4); n > 0; n--){
+        uint32_t at = draw(rom_size);
+        uint32_t even = at & ~1u;
+        switch (draw(7)){
+            case 0: // Flip a bit
+                input[at] ^= 1 << draw(8);
+                break;
+
+            case 1: // Random byte
+                input[at] = draw(256);
+                break;
+
+            case 2: // Random instruction
+                if (even + 1 < rom_size){
+                    input[even] = draw(256);
+                    input[even + 1] = draw(256);
+                }
+                break;
+
+            case 3: // Copy an instruction
+                if (even + 1 < rom_size){
+                    uint32_t from = draw(rom_size) & ~1u;
+                    input[even] = input[from];
+                    input[even + 1] = input[from + 1 < rom_size ? from + 1 : from];
+                }
+                break;
+
+            case 4: // Key of a frame
+                input[rom_size + draw(frames)] = draw(NB_KEYS + 1) == NB_KEYS ? NO_KEY : draw(NB_KEYS);
+                break;
+
+            case 5: { // Key held during frames
+                uint32_t first = draw(frames);
+                uint32_t length = 1 + draw(frames - first);
+                memset(input + rom_size + first, draw(NB_KEYS + 1) == NB_KEYS ? NO_KEY : draw(NB_KEYS), length);
+                break;
+            }
+
+            default: { // Bytes of another input
+                uint8_t* other = corpus + draw(corpus_count) * input_size;
+                uint32_t length = 1 + draw(rom_size - at);
+                memcpy(input + at, other + at, length);
+                break;
+            }
+        }
+    }
+}
+
+/* Name of the FAULT_ flags. */
+static const char* fault_name(uint8_t kind){
+    switch (kind){
+        case FAULT_MEMORY: return "memory past 0xFFFF";
+        case FAULT_STACK_OVERFLOW: return "stack overflow";
+        case FAULT_STACK_UNDERFLOW: return "stack underflow";
+        case FAULT_KEY: return "key above F";
+        default: return "several faults";
+    }
+}
+
+int main(int argc, char* argv[]){
+    char* roms[FUZZ_CORPUS];
+    uint32_t rom_count = 0;
+    double seconds = FUZZ_SECONDS;
+    uint64_t max_executions = 0;
+
+    for (int k = 1; k < argc; k++){
+        if (strcmp(argv[k], "--seconds") == 0 && k + 1 < argc){
+            seconds = atof(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--executions") == 0 && k + 1 < argc){
+            max_executions = strtoull(argv[++k], NULL, 10);
+        }
+        else if (strcmp(argv[k], "--frames") == 0 && k + 1 < argc){
+            frames = strtoul(argv[++k], NULL, 10);
+        }
+        else if (strcmp(argv[k], "--seed") == 0 && k + 1 < argc){
+            rng = strtoul(argv[++k], NULL, 0) | 1;
+        }
+        else if (strcmp(argv[k], "--out") == 0 && k + 1 < argc){
+            out_directory = argv[++k];
+        }
+        else if (rom_count < FUZZ_CORPUS / 2){
+            roms[rom_count++] = argv[k];
+        }
+    }
+    if (rom_count == 0 || frames == 0){
+        printf("You must give at least one rom.\n");
+        printf("Usage : %s [--seconds <s>] [--executions <n>] [--frames <n>] [--seed <n>] [--out <directory>] <rom>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (out_directory != NULL){
+        mkdir(out_directory, 0755);
+    }
+
+    // The seeds are the first inputs, padded to the biggest one, without keys
+    uint8_t* seeds = calloc(rom_count, FUZZ_MAX_ROM);
+    for (uint32_t k = 0; k < rom_count; k++){
+        FILE* rom = fopen(roms[k], "rb");
+        if (rom == NULL){
+            fprintf(stderr, "Unable to load the ROM %s.\n", roms[k]);
+            return EXIT_FAILURE;
+        }
+        uint32_t size = fread(seeds + (size_t) k * FUZZ_MAX_ROM, 1, FUZZ_MAX_ROM, rom);
+        fclose(rom);
+        rom_size = size > rom_size ? size : rom_size;
+    }
+    if (rom_size < 2){
+        rom_size = 2;
+    }
+    input_size = rom_size + frames;
+    corpus = calloc(FUZZ_CORPUS + 1, input_size);
+    if (corpus == NULL || seeds == NULL){
+        fprintf(stderr, "Unable to allocate the corpus.\n");
+        return EXIT_FAILURE;
+    }
+    for (uint32_t k = 0; k < rom_count; k++){
+        memcpy(corpus + (size_t) k * input_size, seeds + (size_t) k * FUZZ_MAX_ROM, rom_size);
+        memset(corpus + (size_t) k * input_size + rom_size, NO_KEY, frames);
+    }
+    corpus_count = rom_count;
+    free(seeds);
+
+    cpu_context = &work;
+    initialize();
+    base = work;
+
+    // The last slot of the corpus holds the input being run
+    uint8_t* input = corpus + (size_t) FUZZ_CORPUS * input_size;
+    uint64_t execution = 0;
+    for (uint32_t k = 0; k < rom_count; k++){
+        execute(corpus + (size_t) k * input_size, execution++);
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 report = start;
+    double elapsed = 0;
+    while ((max_executions == 0 || execution < max_executions) && elapsed < seconds){
+        mutate(input);
+        if (execute(input, execution++) > 0){
+            // Once the corpus is full, new inputs replace the old ones, the seeds stay
+            uint32_t slot = corpus_count < FUZZ_CORPUS ? corpus_count++ : rom_count + draw(FUZZ_CORPUS - rom_count);
+            memcpy(corpus + (size_t) slot * input_size, input, input_size);
+        }
+        if ((execution & 0xFF) == 0){
+            Uint64 now = SDL_GetPerformanceCounter();
+            elapsed = (double) (now - start) / SDL_GetPerformanceFrequency();
+            if (now - report > SDL_GetPerformanceFrequency()){
+                report = now;
+                printf("%10lu executions, %8.0f executions/s, corpus %4u, PC edges %5u, opcode edges %5u, faults %u\n",
+                       (unsigned long) execution, execution / elapsed, corpus_count, pc_edge_count, opcode_edge_count, fault_count);
+            }
+        }
+    }
+    elapsed = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    printf("%lu executions in %.2fs (%.0f executions/s), corpus %u, PC edges %u, opcode edges %u\n", (unsigned long) execution,
+           elapsed, execution / elapsed, corpus_count, pc_edge_count, opcode_edge_count);
+    for (uint32_t k = 0; k < fault_count; k++){
+        printf("fault at %04X (%04X) : %s, execution %lu\n", faults[k].PC, faults[k].opcode, fault_name(faults[k].kind),
+               (unsigned long) faults[k].execution);
+    }
+    free(corpus);
+    return fault_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,415 @@
+/**
+ * @file host.c
+ * @author Xavier Monard
+ * @brief Multi-session host : one process runs a machine per client connected on a Unix
+ * socket. A few worker threads run the sessions one frame at a time, clients send key
+ * events and receive the framebuffer rows changed by each frame.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "include/host.h"
+
+static cpu template;
+static session* run_head = NULL;
+static session* run_tail = NULL;
+static session* parked[HOST_SESSIONS];
+static uint32_t parked_count = 0;
+static SDL_mutex* queue_lock = NULL;
+static SDL_cond* queue_ready = NULL;
+static SDL_atomic_t session_count;
+static SDL_atomic_t frame_count;
+static volatile sig_atomic_t running = 1;
+
+/* Current time in us. */
+static uint64_t now(){
+    return SDL_GetPerformanceCounter() * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+/* Stop the host on SIGINT and SIGTERM. */
+static void stop(int signal_number){
+    (void) signal_number;
+    running = 0;
+}
+
+/**
+ * @brief Put a session in the run queue. Sessions due now go first, the others are due
+ * one frame after the sessions already queued, so the queue stays sorted.
+ *
+ * @param s The session.
+ * @param first 1 to run it before the queued sessions.
+ */
+static void enqueue(session* s, uint8_t first){
+    SDL_LockMutex(queue_lock);
+    if (first){
+        s->next = run_head;
+        run_head = s;
+        if (run_tail == NULL){
+            run_tail = s;
+        }
+    }
+    else {
+        s->next = NULL;
+        if (run_tail == NULL){
+            run_head = s;
+        }
+        else {
+            run_tail->next = s;
+        }
+        run_tail = s;
+    }
+    SDL_CondSignal(queue_ready);
+    SDL_UnlockMutex(queue_lock);
+}
+
+/* Take the first session of the run queue once it is due, NULL if the host stops. */
+static session* dequeue(){
+    session* s = NULL;
+
+    SDL_LockMutex(queue_lock);
+    while (running && s == NULL){
+        if (run_head == NULL){
+            SDL_CondWaitTimeout(queue_ready, queue_lock, 100);
+            continue;
+        }
+        uint64_t time = now();
+        if (run_head->due > time){
+            // A session due now may be queued in front meanwhile
+            SDL_CondWaitTimeout(queue_ready, queue_lock, (run_head->due - time) / 1000 + 1);
+            continue;
+        }
+        s = run_head;
+        run_head = s->next;
+        if (run_head == NULL){
+            run_tail = NULL;
+        }
+    }
+    SDL_UnlockMutex(queue_lock);
+    return s;
+}
+
+/* Park a session waiting for a key, the main thread polls its socket. */
+static void park(session* s){
+    SDL_LockMutex(queue_lock);
+    s->parked = 1;
+    parked[parked_count++] = s;
+    SDL_UnlockMutex(queue_lock);
+}
+
+/* Put back in the run queue a parked session whose client sent something. The timers run for the missed frames. */
+static void unpark(uint32_t index){
+    session* s = parked[index];
+    uint64_t time = now();
+    uint64_t missed = time > s->due ? (time - s->due) / FRAME_PERIOD : 0;
+
+    parked[index] = parked[--parked_count];
+    s->parked = 0;
+    s->machine.delay -= missed < s->machine.delay ? missed : s->machine.delay;
+    s->machine.sound_timer -= missed < s->machine.sound_timer ? missed : s->machine.sound_timer;
+    s->frame += missed;
+    s->due = time;
+}
+
+/**
+ * @brief Write the pending message to the client, without blocking.
+ *
+ * @param s The session.
+ * @return uint8_t 0 if the client is gone.
+ */
+static uint8_t flush(session* s){
+    while (s->out_sent < s->out_size){
+        ssize_t n = write(s->socket, s->out + s->out_sent, s->out_size - s->out_sent);
+        if (n < 0){
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        s->out_sent += n;
+    }
+    s->out_size = 0;
+    s->out_sent = 0;
+    return 1;
+}
+
+/**
+ * @brief Send the rows changed since the last message. While the client has not read the
+ * previous message, changes accumulate in the next one.
+ *
+ * @param s The session.
+ * @return uint8_t 0 if the client is gone.
+ */
+static uint8_t send_delta(session* s){
+    framebuffer* screen = &s->machine.screen;
+    frame_delta header = {s->frame, 0, screen->hires, 0};
+    uint32_t size = sizeof(header);
+
+    if (flush(s) == 0){
+        return 0;
+    }
+    if (s->out_size > 0){
+        return 1;
+    }
+    // The client clears its screen when the resolution changes
+    if (screen->hires != s->sent.hires){
+        memset(s->sent.rows, 0, sizeof(s->sent.rows));
+        s->sent.hires = screen->hires;
+    }
+    for (uint8_t plane = 0; plane < PLANES; plane++){
+        for (uint8_t y = 0; y < SCREEN_HEIGTH; y++){
+            if (memcmp(screen->rows[plane][y], s->sent.rows[plane][y], sizeof(screen->rows[plane][y])) != 0){
+                row_delta row = {{0}, plane, y, {0}};
+                memcpy(row.words, screen->rows[plane][y], sizeof(row.words));
+                memcpy(s->sent.rows[plane][y], screen->rows[plane][y], sizeof(row.words));
+                memcpy(s->out + size, &row, sizeof(row));
+                size += sizeof(row);
+                header.rows++;
+            }
+        }
+    }
+    if (header.rows == 0 && s->frame > 1){
+        return 1;
+    }
+    memcpy(s->out, &header, sizeof(header));
+    s->out_size = size;
+    return flush(s);
+}
+
+/**
+ * @brief Read the key events of the client.
+ *
+ * @param s The session.
+ * @return uint8_t 0 if the client is gone.
+ */
+static uint8_t read_keys(session* s){
+    uint8_t bytes[64 * sizeof(key_event)];
+
+    for (;;){
+        // The stream may split an event anywhere, its first bytes were kept by the previous read
+        memcpy(bytes, s->in, s->in_size);
+        ssize_t n = read(s->socket, bytes + s->in_size, sizeof(bytes) - s->in_size);
+        if (n == 0){
+            return 0;
+        }
+        if (n < 0){
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        n += s->in_size;
+        ssize_t whole = n - n % sizeof(key_event);
+        for (ssize_t k = 0; k < whole; k += sizeof(key_event)){
+            key_event event;
+            memcpy(&event, bytes + k, sizeof(event));
+            set_key(event.key & 0xF, event.state ? KEY_PRESSED : KEY_UNPRESSED);
+        }
+        s->in_size = n - whole;
+        memcpy(s->in, bytes + whole, s->in_size);
+    }
+}
+
+/**
+ * @brief Run one frame of a session on the calling thread.
+ *
+ * @param s The session.
+ * @return uint8_t 0 if the session is over (client gone or 00FD).
+ */
+static uint8_t run_session(session* s){
+    uint8_t keep_up = 1;
+
+    cpu_context = &s->machine;
+    if (read_keys(s) == 0){
+        return 0;
+    }
+    for (int actions = 0; actions<CPU_SPEED && keep_up == 1 && CPU.waiting == 0; actions++){
+        keep_up = step();
+    }
+    time_count();
+    s->frame++;
+    SDL_AtomicAdd(&frame_count, 1);
+    if (keep_up == 0 || send_delta(s) == 0){
+        return 0;
+    }
+
+    s->due += FRAME_PERIOD;
+    if (CPU.waiting){
+        park(s);
+    }
+    else {
+        enqueue(s, 0);
+    }
+    return 1;
+}
+
+/* Close a session. */
+static void close_session(session* s){
+    close(s->socket);
+    free(s);
+    SDL_AtomicAdd(&session_count, -1);
+}
+
+/* Worker thread, runs the due sessions. */
+static int worker_main(void* data){
+    (void) data;
+    while (running){
+        session* s = dequeue();
+        if (s != NULL && run_session(s) == 0){
+            close_session(s);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Create a session for a new client, a copy of the machine with the ROM loaded.
+ *
+ * @param client The connection.
+ */
+static void open_session(int client){
+    session* s = calloc(1, sizeof(session));
+
+    if (s == NULL || SDL_AtomicGet(&session_count) >= HOST_SESSIONS){
+        close(client);
+        free(s);
+        return;
+    }
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+    s->machine = template;
+    s->sent = template.screen;
+    s->socket = client;
+    s->due = now();
+    SDL_AtomicAdd(&session_count, 1);
+    enqueue(s, 1);
+}
+
+/* Create the listening socket. */
+static int open_socket(char* path){
+    struct sockaddr_un address;
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+    if (server < 0 || bind(server, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(server, 64) < 0){
+        fprintf(stderr, "Unable to listen on %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fcntl(server, F_SETFL, fcntl(server, F_GETFL) | O_NONBLOCK);
+    return server;
+}
+
+int main(int argc, char* argv[]){
+    char* rom_name = NULL;
+    char* socket_path = HOST_SOCKET;
+    int threads = HOST_THREADS;
+
+    for (int k = 1; k < argc; k++){
+        if (strcmp(argv[k], "--socket") == 0 && k + 1 < argc){
+            socket_path = argv[++k];
+        }
+        else if (strcmp(argv[k], "--threads") == 0 && k + 1 < argc){
+            threads = atoi(argv[++k]);
+        }
+        else {
+            rom_name = argv[k];
+        }
+    }
+    if (rom_name == NULL || threads < 1){
+        printf("You must give a rom.\n");
+        printf("Usage : %s [--socket <path>] [--threads <n>] <rom>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (SDL_Init(0) == -1){
+        fprintf(stderr, "Unable to launch SDL :\n %s", SDL_GetError());
+        return EXIT_FAILURE;
+    }
+    initialize();
+    load_game(rom_name);
+    template = CPU;
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    int server = open_socket(socket_path);
+    queue_lock = SDL_CreateMutex();
+    queue_ready = SDL_CreateCond();
+
+    SDL_Thread** workers = malloc(threads * sizeof(SDL_Thread*));
+    for (int k = 0; k < threads; k++){
+        workers[k] = SDL_CreateThread(worker_main, "host worker", NULL);
+    }
+    printf("Serving %s on %s with %d threads\n", rom_name, socket_path, threads);
+
+    // New clients and parked sessions are polled here, the running sessions read their own sockets
+    struct pollfd fds[HOST_SESSIONS + 1];
+    session* polled[HOST_SESSIONS];
+    uint64_t report = now();
+    while (running){
+        uint32_t count = 0;
+        fds[count++] = (struct pollfd) {server, POLLIN, 0};
+        SDL_LockMutex(queue_lock);
+        for (uint32_t k = 0; k < parked_count; k++){
+            polled[count - 1] = parked[k];
+            fds[count++] = (struct pollfd) {parked[k]->socket, POLLIN, 0};
+        }
+        SDL_UnlockMutex(queue_lock);
+
+        if (poll(fds, count, 10) > 0){
+            if (fds[0].revents & POLLIN){
+                int client;
+                while ((client = accept(server, NULL, NULL)) >= 0){
+                    open_session(client);
+                }
+            }
+            // Only this thread takes sessions out of the parked list
+            for (uint32_t k = 1; k < count; k++){
+                if (fds[k].revents != 0){
+                    SDL_LockMutex(queue_lock);
+                    for (uint32_t j = 0; j < parked_count; j++){
+                        if (parked[j] == polled[k - 1]){
+                            unpark(j);
+                            break;
+                        }
+                    }
+                    SDL_UnlockMutex(queue_lock);
+                    enqueue(polled[k - 1], 1);
+                }
+            }
+        }
+        if (now() - report >= 5000000){
+            printf("%d sessions, %.1f frames/s\n", SDL_AtomicGet(&session_count),
+                   SDL_AtomicSet(&frame_count, 0) * 1e6 / (now() - report));
+            report = now();
+        }
+    }
+
+    SDL_LockMutex(queue_lock);
+    SDL_CondBroadcast(queue_ready);
+    SDL_UnlockMutex(queue_lock);
+    for (int k = 0; k < threads; k++){
+        SDL_WaitThread(workers[k], NULL);
+    }
+    free(workers);
+    while (run_head != NULL){
+        session* s = run_head;
+        run_head = s->next;
+        close_session(s);
+    }
+    while (parked_count > 0){
+        close_session(parked[--parked_count]);
+    }
+    close(server);
+    unlink(socket_path);
+    SDL_Quit();
+    return EXIT_SUCCESS;
+}
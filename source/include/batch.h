@@ -0,0 +1,83 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/* Includes */
+
+#include <stdint.h>
+#include "cpu.h"
+#include "display.h"
+
+/* Macros */
+
+#ifndef BATCH_LANES
+#define BATCH_LANES 16 // Machines stepped together, 8, 16 or 32
+#endif
+#define BATCH_VECTOR 32 // Bytes of an AVX2 register
+#define BATCH_STRIDE (((BATCH_LANES + BATCH_VECTOR - 1) / BATCH_VECTOR) * BATCH_VECTOR) // Lanes padded to whole vectors
+#define LANE_ON 0xFF
+#define LANE_OFF 0x00
+#define BATCH_SPLIT_GROUPS 1 // Above this many groups in a step, the machines run one by one
+#define BATCH_SPLIT_STEPS 256 // Steps run machine by machine before grouping the lanes again
+#define BATCH_SPLIT_MAX_FRAMES 1024 // Longest block of frames run machine by machine by batch_run()
+
+/* Structs */
+
+/**
+ * @brief Machines running the same ROM. Their registers are stored in structure of arrays form : register k of
+ * machine l is V[k][l]. Rows are padded to BATCH_STRIDE lanes, the padding lanes are never active.
+ * Lanes sharing their PC execute their instruction together with masked vector operations. Memory, screen
+ * and audio pattern stay in the machines. While split is not 0, the registers are in the machines too and
+ * the rows are stale : the machines run one by one with the scalar core.
+ *
+ * @param V The 16 registers of every lane.
+ * @param I I of every lane.
+ * @param PC Program counter of every lane.
+ * @param delay Delay timer of every lane.
+ * @param sound_timer Sound timer of every lane.
+ * @param stack_pointer Stack pointer of every lane.
+ * @param stack The stacks, stack[k][l] is the level k of lane l.
+ * @param keyboard Keys of every lane, set by batch_key().
+ * @param rpl The SUPER-CHIP RPL user flags of every lane.
+ * @param pitch The XO-CHIP audio pattern pitch of every lane.
+ * @param pattern_loaded 1 once the lane loaded an audio pattern.
+ * @param active LANE_ON while the lane runs, LANE_OFF once it executed 00FD.
+ * @param rng State of the Cxkk generator of every lane.
+ * @param waiting 1 while the lane waits for a key (Fx0A).
+ * @param wait_register The register receiving the key of Fx0A.
+ * @param split Steps left to run the machines one by one, set when the lanes diverged into too many groups.
+ * @param split_frames Frames of the next block of batch_run() running the machines one by one.
+ * @param machines The machine of every lane, the opcode gather reads their memory with a stride of sizeof(cpu).
+ */
+typedef struct {
+    uint8_t V[REGISTER_NUMBER][BATCH_STRIDE];
+    uint16_t I[BATCH_STRIDE];
+    uint16_t PC[BATCH_STRIDE];
+    uint8_t delay[BATCH_STRIDE];
+    uint8_t sound_timer[BATCH_STRIDE];
+    uint8_t stack_pointer[BATCH_STRIDE];
+    uint16_t stack[STACK_SIZE][BATCH_STRIDE];
+    uint8_t keyboard[NB_KEYS][BATCH_STRIDE];
+    uint8_t rpl[RPL_FLAGS][BATCH_STRIDE];
+    uint8_t pitch[BATCH_STRIDE];
+    uint8_t pattern_loaded[BATCH_STRIDE];
+    uint8_t active[BATCH_STRIDE];
+    uint32_t rng[BATCH_STRIDE];
+    uint8_t waiting[BATCH_STRIDE];
+    uint8_t wait_register[BATCH_STRIDE];
+    uint32_t split;
+    uint32_t split_frames;
+    cpu machines[BATCH_LANES];
+} batch;
+
+/* Functions */
+
+batch* batch_create(cpu* machine);
+void batch_destroy(batch* b);
+void batch_load(batch* b, uint8_t lane, cpu* machine);
+void batch_store(batch* b, uint8_t lane, cpu* machine);
+uint32_t batch_step(batch* b);
+uint64_t batch_run(batch* b, uint32_t frames);
+void batch_time_count(batch* b);
+void batch_key(batch* b, uint8_t lane, uint8_t key, uint8_t state);
+
+#endif /* BATCH_H */
@@ -0,0 +1,56 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+/* Includes */
+
+#include <stdint.h>
+#include "display.h"
+
+/* Macros */
+
+#define CAPTURE_MAGIC "C8CP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_SLOTS 64 // Frames queued for the writer, frames are dropped when it lags behind
+#define CAPTURE_KEY_INTERVAL 600 // Frames between two complete frames, to seek in a capture
+#define CAPTURE_BITMAP_SIZE (PLANES * SCREEN_HEIGTH * SCREEN_WIDTH / 8) // Both planes in 128x64, 1 bit per pixel
+#define CAPTURE_MAX_ENCODED (CAPTURE_BITMAP_SIZE + CAPTURE_BITMAP_SIZE / 128 + 1)
+#define CAPTURE_KEY 0 // Complete frame
+#define CAPTURE_DELTA 1 // Frame XORed with the previous one
+#define CAPTURE_LITERAL 0x00 // Token followed by 1 to 128 bytes
+#define CAPTURE_ZEROS 0x80 // Token standing for 1 to 128 zero bytes
+
+/* Structs */
+
+/**
+ * @brief Header of a captured frame in the capture file, followed by its encoded bitmap.
+ *
+ * The bitmap holds the visible rows of plane 0 then plane 1, 8 pixels per byte, leftmost pixel
+ * in the high bit. It is stored as tokens : a byte below 0x80 is followed by that many + 1 literal
+ * bytes, a byte from 0x80 stands for (byte - 0x7F) zero bytes.
+ *
+ * @param frame Number of the emulated frame.
+ * @param time Time of the frame since the start of the capture, in us.
+ * @param hires 1 in the 128x64 mode.
+ * @param kind CAPTURE_KEY or CAPTURE_DELTA, a delta is XORed with the previous bitmap.
+ * @param size Size of the encoded bitmap.
+ */
+typedef struct {
+    uint32_t frame;
+    uint32_t time;
+    uint8_t hires;
+    uint8_t kind;
+    uint16_t size;
+} capture_header;
+
+/* Functions */
+
+uint8_t capture_open(char* capture_path);
+void capture_frame(framebuffer* fb, uint64_t frame);
+void capture_screenshot(framebuffer* fb, uint64_t frame);
+void capture_close();
+uint32_t capture_bitmap(framebuffer* fb, uint8_t* bitmap);
+void capture_framebuffer(uint8_t* bitmap, uint8_t hires, framebuffer* fb);
+uint32_t capture_encode(uint8_t* bitmap, uint32_t size, uint8_t* out);
+uint32_t capture_decode(uint8_t* data, uint32_t size, uint8_t* bitmap, uint32_t bitmap_size);
+
+#endif /* CAPTURE_H */
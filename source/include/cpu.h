@@ -4,11 +4,13 @@
 /* Includes */
 
 #include <stdint.h>
+#include <stddef.h>
 #include <SDL2/SDL.h>
+#include "display.h"
 
 /* Macros */
 
-#define MEMORY_SIZE 4069
+#define MEMORY_SIZE 0x10000
 #define READ_AREA 0x200
 #define REGISTER_NUMBER 16
 #define STACK_SIZE 16
@@ -16,23 +18,43 @@
 #define FPS 16 // ms
 #define TIME_FREQUENCY 60 // Hz
 #define DIGIT_PATH "./digit"
+#define BIG_DIGIT_AREA 0x50
+#define RPL_FLAGS 16
+#define AUDIO_PATTERN_SIZE 16
+#define DEFAULT_PITCH 64
 #define NB_KEYS 16
 #define KEY_PRESSED 1
 #define KEY_UNPRESSED 0
+#define RNG_SEED 0x2545F491 // Default state of the Cxkk generator
+#define THREAD_LOCAL __thread // Per thread storage, GCC and Clang
+#define FAULT_MEMORY 0x1 // An access starting at I went past the end of memory and wrapped to 0
+#define FAULT_STACK_OVERFLOW 0x2 // 2nnn with a full stack, the last return address was overwritten
+#define FAULT_STACK_UNDERFLOW 0x4 // 00EE with an empty stack, ignored
+#define FAULT_KEY 0x8 // Ex9E or ExA1 with Vx above F, the key Vx & F was tested
 
 /* Structs */
 
 /**
  * @brief Structure containing the element to simulate the CPU. 
- * @param ram An array of 1 bytes of size 4069.
+ * @param ram An array of 1 bytes of size 65536 (XO-CHIP address space).
  * @param V An array containing the 16 registers of 1 byte size.
- * @param I A 2 bytes value.
+ * @param I A 2 bytes value, the whole 16 bits are used by XO-CHIP.
  * @param PC A 2 bytes program counter.
  * @param delay A 1 byte delay timer register.
  * @param sound_timer A 1 byte sound timer register.
  * @param stack The stack of the CPU, its size is 16.
  * @param stack_pointer The pointer of last occupied value in stack. 
- * @param keyboard a table indicating if key were pressed. */
+ * @param keyboard a table indicating if key were pressed.
+ * @param screen The packed screen, part of the machine state.
+ * @param rpl The SUPER-CHIP RPL user flags (Fx75 and Fx85).
+ * @param pattern The XO-CHIP 128 bits audio pattern (F002).
+ * @param pattern_loaded 1 once a pattern was loaded, the buzzer plays a plain tone before.
+ * @param pitch The XO-CHIP audio pattern playback pitch (Fx3A).
+ * @param rng State of the xorshift generator of Cxkk, so that copies of a machine can be replayed.
+ * @param waiting 1 while Fx0A waits for a key, the instruction is executed again until set_key() resolves it.
+ * @param wait_register The register receiving the key of Fx0A.
+ * @param fault FAULT_ flags of the invalid accesses made by the program, set by the core and cleared by its users.
+ * @param xochip 1 once the program ran an XO-CHIP instruction, Fx1E then wraps I on 16 bits. */
 typedef struct {
     uint8_t ram[MEMORY_SIZE];
     uint8_t V[REGISTER_NUMBER];
@@ -42,11 +64,30 @@ typedef struct {
     uint16_t stack[STACK_SIZE];
     uint8_t stack_pointer;
     uint8_t keyboard[NB_KEYS];
+    framebuffer screen;
+    uint8_t rpl[RPL_FLAGS];
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+    uint8_t pattern_loaded;
+    uint8_t pitch;
+    uint32_t rng;
+    uint8_t waiting;
+    uint8_t wait_register;
+    uint8_t fault;
+    uint8_t xochip;
 } cpu;
 
+/* The machine after its memory, saved apart from the memory by the snapshots of the explorer and the fuzzer. */
+#define MACHINE_OFFSET offsetof(cpu, V)
+#define MACHINE_SIZE (sizeof(cpu) - MACHINE_OFFSET)
+
+/* The memory must be the first member, MACHINE_OFFSET then covers everything else */
+typedef char cpu_memory_first_check[(offsetof(cpu, ram) == 0) ? 1 : -1];
+
 /* Globals */
 
-extern cpu CPU;
+/* The machine run by the calling thread, a host switches it between sessions. */
+extern THREAD_LOCAL cpu* cpu_context;
+#define CPU (*cpu_context)
 
 /* Functions */
 
@@ -54,9 +95,12 @@ void initialize();
 void time_count();
 uint16_t get_opcode();
 uint8_t interpret_opcode(uint16_t opcode);
-void load_digit(char* digit_binary);
+uint8_t step();
+uint8_t load_digit(char* digit_binary);
 void load_game(char* rom_name);
 void draw_sprite(uint8_t x, uint8_t y, uint8_t height);
-uint8_t wait_for_key(Uint8 b);
+void set_key(uint8_t key, uint8_t state);
+uint8_t random_byte(uint32_t* state);
+uint8_t* wrap_memory(uint8_t* ram, uint16_t address, uint32_t length, uint8_t* buffer);
 
 #endif /* CPU_H */
@@ -0,0 +1,45 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+/* Includes */
+
+#include <stdint.h>
+
+/* Macros */
+
+#define DEBUG_WATCHES 32
+#define DEBUG_LINE_SIZE 128
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+#define WATCH_I 16 // Bit of I in the register watch mask, after V0 to VF
+
+/* Structs */
+
+/**
+ * @brief A watched memory range.
+ *
+ * @param first First watched address.
+ * @param length Number of watched bytes.
+ * @param kind WATCH_READ, WATCH_WRITE or both.
+ */
+typedef struct {
+    uint16_t first;
+    uint32_t length;
+    uint8_t kind;
+} watchpoint;
+
+/* Globals */
+
+extern uint32_t executed; // Instructions and timer decrements of the frame, defined by emulator.c for the telemetry
+extern uint32_t counted;
+
+/* Functions */
+
+void debug_open();
+uint8_t debug_enabled();
+uint8_t debug_needed();
+void debug_poll();
+void debug_command(char* line);
+uint8_t debug_frame(uint64_t frame, uint8_t timed);
+
+#endif /* DEBUGGER_H */
@@ -0,0 +1,49 @@
+#ifndef DIFFCHECK_H
+#define DIFFCHECK_H
+
+/* Includes */
+
+#include <stdint.h>
+#include "cpu.h"
+#include "movie.h"
+
+/* Macros */
+
+#define DIFF_FRAMES 3600 // One minute of play for each ROM
+#define DIFF_MOVIE_SIZE 0x10000 // Frames of a movie
+
+/* Structs */
+
+/**
+ * @brief An execution engine, driven one instruction at a time. Each engine runs a single machine.
+ *
+ * @param name Name given on the command line.
+ * @param load Overwrite the machine of the engine.
+ * @param store Copy the machine of the engine.
+ * @param step Execute one instruction, return 0 when the game exited.
+ * @param time_count Decrement the timers, once per frame.
+ * @param key Press or release a key.
+ */
+typedef struct {
+    const char* name;
+    void (*load)(cpu* machine);
+    void (*store)(cpu* machine);
+    uint8_t (*step)();
+    void (*time_count)();
+    void (*key)(uint8_t key, uint8_t state);
+} engine;
+
+/**
+ * @brief Progress of an engine in the movie.
+ *
+ * @param executed Instructions executed from the start.
+ * @param held The key held, NO_KEY for none.
+ * @param exited 1 once the game exited.
+ */
+typedef struct {
+    uint64_t executed;
+    uint8_t held;
+    uint8_t exited;
+} position;
+
+#endif /* DIFFCHECK_H */
@@ -0,0 +1,19 @@
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Macros */
+
+#define MNEMONIC_SIZE 32
+
+/* Functions */
+
+void translate_opcode(int* hexa, char* text, size_t size);
+void disassemble(uint16_t opcode, char* text, size_t size);
+
+#endif /* DISASSEMBLER_H */
@@ -3,41 +3,52 @@
 
 /* Includes */
 
+#include <stdio.h>
 #include <stdint.h>
 #include <SDL2/SDL.h>
 
 /* Macros */
 
-#define PIXEL_SIZE 8
-#define SCREEN_WIDTH  64
-#define SCREEN_HEIGTH 32
+#define PIXEL_SIZE 4
+#define SCREEN_WIDTH  128
+#define SCREEN_HEIGTH 64
+#define LORES_WIDTH 64
+#define LORES_HEIGTH 32
+#define ROW_WORDS (SCREEN_WIDTH / 64)
+#define PLANES 2
 #define WIDTH SCREEN_WIDTH * PIXEL_SIZE
 #define HEIGHT SCREEN_HEIGTH * PIXEL_SIZE
 #define PIXEL_BLACK 0
 #define PIXEL_WHITE 1
+#define COLOR_BLACK 0xFF000000
+#define COLOR_WHITE 0xFFFFFFFF
+#define COLOR_PLANE_2 0xFFAAAAAA
+#define COLOR_BOTH_PLANES 0xFF555555
 #define HEX_REP_SIZE 5
+#define BIG_HEX_REP_SIZE 10
 
 /* Structs */
 
 /**
- * @brief Structure representing a screen pixel
- * 
- * @param position A SDL structure definng x,y,h and w.
- * @param couleur The color of the pixel.
+ * @brief Packed screen of our emulator, made of two 1 bit per pixel XO-CHIP bitplanes.
+ *
+ * Each row is stored in 64 bits words, the leftmost pixel being the most significant bit.
+ * In low resolution only the 32 first rows and the first word of each row are used,
+ * so both modes cost the same per row. CHIP-8 and SUPER-CHIP games only draw in the first plane.
+ *
+ * @param rows The pixels, rows[plane][y][x / 64] >> (63 - x % 64) & 1.
+ * @param hires 1 in the 128x64 SUPER-CHIP mode, 0 in the 64x32 mode.
+ * @param planes Bitmask of the planes affected by drawing, clearing and scrolling (Fn01).
  */
 typedef struct {
-    SDL_Rect position;
-    uint8_t couleur;
-} pixel;
+    uint64_t rows[PLANES][SCREEN_HEIGTH][ROW_WORDS];
+    uint8_t hires;
+    uint8_t planes;
+} framebuffer;
 
 /* Globals */
 
-/**
- * @brief Screen of our emulator.
- * 
- */
-extern pixel screen[SCREEN_WIDTH][SCREEN_HEIGTH];
-extern SDL_Texture *sdl_texture[2];
+extern SDL_Texture *sdl_texture;
 extern SDL_Window * sdl_window;
 extern SDL_Renderer * sdl_renderer;
 extern SDL_Event sdl_event;
@@ -45,9 +56,18 @@ extern SDL_Event sdl_event;
 /* Functions*/
 
 void initialize_screen();
-void draw_pixel(pixel pixel);
 void update_screen();
 void clear_screen();
 void initialize_sdl();
+void render_framebuffer(framebuffer* fb);
+void write_pbm(FILE* file, framebuffer* fb);
+void clear_framebuffer(framebuffer* fb);
+void set_resolution(framebuffer* fb, uint8_t hires);
+void select_planes(framebuffer* fb, uint8_t planes);
+uint8_t blit_sprite(framebuffer* fb, uint8_t* sprite, uint8_t x, uint8_t y, uint8_t height, uint8_t wide);
+void scroll_down(framebuffer* fb, uint8_t n);
+void scroll_up(framebuffer* fb, uint8_t n);
+void scroll_right(framebuffer* fb);
+void scroll_left(framebuffer* fb);
 
 #endif /* DISPLAY_H */
@@ -0,0 +1,70 @@
+#ifndef EXPLORER_H
+#define EXPLORER_H
+
+/* Includes */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <SDL2/SDL.h>
+#include "cpu.h"
+#include "movie.h"
+
+/* Macros */
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+#define HASH_SHARDS 256
+#define EXPLORER_STATES 100000 // Default limit of visited states
+#define EXPLORER_DEPTH 20
+#define EXPLORER_FRAMES 4 // Frames a key is held, then released
+#define ACTIONS (NB_KEYS + 1) // No key, or one of the 16 keys
+#define SMALL_MEMORY 0x1000 // Memory saved in snapshots of CHIP-8 and SUPER-CHIP games
+
+/* Structs */
+
+/**
+ * @brief A block of an arena, snapshots are allocated one after the other in it.
+ *
+ * @param next Next block of the arena or of the pool.
+ * @param used Bytes allocated in the block.
+ * @param data The snapshots.
+ */
+typedef struct arena_block {
+    struct arena_block* next;
+    size_t used;
+    uint8_t data[];
+} arena_block;
+
+/**
+ * @brief Bump allocator of snapshots, released all at once. Its blocks come from a shared pool.
+ *
+ * @param blocks The blocks, the first one being filled.
+ */
+typedef struct {
+    arena_block* blocks;
+} arena;
+
+/**
+ * @brief How a visited state was reached, to print the inputs leading to the goal.
+ *
+ * @param parent Index of the previous state.
+ * @param action The key held (NO_KEY for none).
+ */
+typedef struct {
+    uint32_t parent;
+    uint8_t action;
+} trail;
+
+/**
+ * @brief A set of state hashes, split in shards with their own lock.
+ *
+ * @param slots Open addressing table, 0 is an empty slot.
+ * @param shard_size Slots of a shard, a power of two.
+ * @param locks One lock per shard.
+ */
+typedef struct {
+    uint64_t* slots;
+    uint32_t shard_size;
+    SDL_mutex* locks[HASH_SHARDS];
+} state_set;
+
+#endif /* EXPLORER_H */
@@ -0,0 +1,37 @@
+#ifndef FUZZER_H
+#define FUZZER_H
+
+/* Includes */
+
+#include <stdint.h>
+#include "cpu.h"
+#include "movie.h"
+
+/* Macros */
+
+#define FUZZ_MAP_SIZE 0x10000 // Entries of the PC and opcode edge maps
+#define FUZZ_CORPUS 4096 // Inputs kept because they found new edges
+#define FUZZ_FRAMES 60 // Frames run by an input
+#define FUZZ_FAULTS 256 // Distinct faults recorded
+#define FUZZ_SECONDS 10
+#define FUZZ_MAX_ROM (MEMORY_SIZE - READ_AREA)
+#define PAGE_SIZE 0x100 // Granularity of the memory restored between two executions
+
+/* Structs */
+
+/**
+ * @brief A distinct fault : its kind and the instruction raising it.
+ *
+ * @param PC Address of the faulting instruction.
+ * @param opcode The faulting instruction.
+ * @param kind The FAULT_ flags raised.
+ * @param execution The execution which found it first.
+ */
+typedef struct {
+    uint16_t PC;
+    uint16_t opcode;
+    uint8_t kind;
+    uint64_t execution;
+} fault_record;
+
+#endif /* FUZZER_H */
@@ -0,0 +1,95 @@
+#ifndef HOST_H
+#define HOST_H
+
+/* Includes */
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "cpu.h"
+#include "display.h"
+
+/* Macros */
+
+#define HOST_SOCKET "/tmp/chip8.sock"
+#define HOST_THREADS 4
+#define HOST_SESSIONS 1024
+#define FRAME_PERIOD (1000000 / TIME_FREQUENCY) // us
+#define MAX_DELTA_SIZE (sizeof(frame_delta) + PLANES * SCREEN_HEIGTH * sizeof(row_delta))
+
+/* Structs */
+
+/**
+ * @brief Key event sent by a client, 2 bytes.
+ *
+ * @param key The key, 0 to F.
+ * @param state KEY_PRESSED or KEY_UNPRESSED.
+ */
+typedef struct {
+    uint8_t key;
+    uint8_t state;
+} key_event;
+
+/**
+ * @brief Header of the message sent to a client after a frame which changed its screen.
+ *
+ * @param frame Number of the frame.
+ * @param rows Number of row_delta following the header.
+ * @param hires 1 in the 128x64 mode, the client clears its screen when it changes.
+ * @param reserved Padding, always 0.
+ */
+typedef struct {
+    uint32_t frame;
+    uint16_t rows;
+    uint8_t hires;
+    uint8_t reserved;
+} frame_delta;
+
+/**
+ * @brief A changed framebuffer row, in the packed format of the framebuffer struct.
+ *
+ * @param words The pixels of the row, in the byte order of the host.
+ * @param plane The bitplane of the row.
+ * @param y The row.
+ * @param reserved Padding, always 0.
+ */
+typedef struct {
+    uint64_t words[ROW_WORDS];
+    uint8_t plane;
+    uint8_t y;
+    uint8_t reserved[6];
+} row_delta;
+
+/**
+ * @brief A client and its machine. Sessions are resumable at frame boundaries : a worker thread
+ * runs one frame then puts the session back in the run queue, due at its next frame. A session
+ * waiting for a key (Fx0A) is parked until its client sends one.
+ *
+ * @param machine The machine of the client.
+ * @param sent The screen as known by the client.
+ * @param socket The connection to the client.
+ * @param frame Frames run so far.
+ * @param due Time of the next frame, in us.
+ * @param parked 1 while the session waits for a key, outside the run queue.
+ * @param out Message not yet completely written to the socket.
+ * @param out_size Size of the message.
+ * @param out_sent Bytes of the message already written.
+ * @param in Start of a key event split by the stream, completed by the next read.
+ * @param in_size Bytes of the split key event.
+ * @param next Next session in the run queue.
+ */
+typedef struct session {
+    cpu machine;
+    framebuffer sent;
+    int socket;
+    uint32_t frame;
+    uint64_t due;
+    uint8_t parked;
+    uint8_t out[MAX_DELTA_SIZE];
+    uint32_t out_size;
+    uint32_t out_sent;
+    uint8_t in[sizeof(key_event)];
+    uint8_t in_size;
+    struct session* next;
+} session;
+
+#endif /* HOST_H */
@@ -0,0 +1,56 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+/* Includes */
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "display.h"
+#include "rom.h"
+
+/* Macros */
+
+#define LAUNCHER_DIRECTORY "game_rom"
+#define LAUNCHER_MAX_ROMS 256
+#define LAUNCHER_NAME_SIZE 256
+#define LAUNCHER_FRAMES 600 // Frames run headless before taking a thumbnail, 10s of emulated time
+#define LAUNCHER_COLUMNS 4
+#define LAUNCHER_ROWS 4
+#define THUMBNAIL_WIDTH (SCREEN_WIDTH / LAUNCHER_COLUMNS)
+#define THUMBNAIL_HEIGTH (SCREEN_HEIGTH / LAUNCHER_ROWS)
+#define LAUNCHER_NONE -1
+
+/* Structs */
+
+/**
+ * @brief A ROM of the launcher, kept in memory so that starting it is a copy.
+ *
+ * @param name File name of the ROM.
+ * @param path Path of the ROM.
+ * @param data The ROM.
+ * @param size Its size.
+ * @param thumbnail Its screen after LAUNCHER_FRAMES frames, reduced to THUMBNAIL_WIDTH x THUMBNAIL_HEIGTH,
+ * a 32 bits word per row, leftmost pixel in the high bit.
+ * @param ready Set to 1 by the thumbnail thread once the thumbnail is done.
+ */
+typedef struct {
+    char name[LAUNCHER_NAME_SIZE];
+    char path[2 * LAUNCHER_NAME_SIZE];
+    uint8_t* data;
+    uint32_t size;
+    uint32_t thumbnail[THUMBNAIL_HEIGTH];
+    SDL_atomic_t ready;
+} launcher_rom;
+
+/* Functions */
+
+uint32_t launcher_open(char* directory);
+void launcher_show();
+void launcher_hide();
+uint8_t launcher_shown();
+int launcher_key(SDL_Keycode key);
+launcher_rom* launcher_get(int index);
+framebuffer* launcher_screen();
+void launcher_close();
+
+#endif /* LAUNCHER_H */
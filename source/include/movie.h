@@ -0,0 +1,25 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Macros */
+
+#define NO_KEY 0xFF // Frame of a movie without any key held
+#define MOVIE_HOLD 30 // Longest key press of a generated movie, in frames
+#define MOVIE_LINE 60 // Frames written on each line of a movie file
+#define HASH_SEED 0x9E3779B97F4A7C15ULL
+
+/* Functions */
+
+char movie_key(uint8_t key);
+uint32_t read_movie(FILE* file, uint8_t* keys, uint32_t size);
+void write_movie(FILE* file, const uint8_t* keys, uint32_t frames);
+void generate_movie(uint8_t* keys, uint32_t frames, uint32_t seed);
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size);
+
+#endif /* MOVIE_H */
@@ -0,0 +1,48 @@
+#ifndef REGRESS_H
+#define REGRESS_H
+
+/* Includes */
+
+#include <stdint.h>
+#include "cpu.h"
+#include "movie.h"
+
+/* Macros */
+
+#define REGRESS_DIR "regression" // Input scripts and goldens, one of each per ROM
+#define REGRESS_ROMS "game_rom"
+#define REGRESS_OUT "regression/failed" // Images of the frames not matching their golden
+#define REGRESS_THREADS 4
+#define REGRESS_MAX_ROMS 256
+#define REGRESS_NAME_SIZE 256
+#define REGRESS_FRAMES 1800 // Frames of a recorded input script
+#define REGRESS_CHECKPOINTS 16
+
+/* Structs */
+
+/**
+ * @brief A ROM of the suite, its script and its checkpoints.
+ *
+ * @param name Name of the ROM file, the script and golden share it.
+ * @param keys Key held during each frame, NO_KEY for none.
+ * @param frames Number of frames of the script.
+ * @param checkpoints Frames whose framebuffer is hashed, in increasing order.
+ * @param expected Hashes of the golden.
+ * @param actual Hashes of this run.
+ * @param count Number of checkpoints.
+ * @param failed First checkpoint not matching, count if all match.
+ * @param exited 1 if the game executed 00FD before the last checkpoint.
+ */
+typedef struct {
+    char name[REGRESS_NAME_SIZE];
+    uint8_t keys[REGRESS_FRAMES];
+    uint32_t frames;
+    uint32_t checkpoints[REGRESS_CHECKPOINTS];
+    uint64_t expected[REGRESS_CHECKPOINTS];
+    uint64_t actual[REGRESS_CHECKPOINTS];
+    uint32_t count;
+    uint32_t failed;
+    uint8_t exited;
+} regression;
+
+#endif /* REGRESS_H */
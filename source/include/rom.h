@@ -0,0 +1,24 @@
+#ifndef ROM_H
+#define ROM_H
+
+/* Includes */
+
+#include <stdint.h>
+#include "cpu.h"
+
+/* Macros */
+
+#define ROM_MAX_SIZE (MEMORY_SIZE - READ_AREA)
+#define ROM_RESET 0 // The machine restarts with the new ROM
+#define ROM_PRESERVE 1 // Only the changed bytes are written, registers, timers and screen are kept
+#define ROM_EVENTS_SIZE 4096 // Bytes of inotify events read at once
+
+/* Functions */
+
+uint32_t read_rom(char* path, uint8_t* data);
+uint32_t apply_rom(uint8_t* data, uint32_t size, uint8_t mode);
+uint8_t rom_watch(char* path);
+uint8_t rom_changed();
+void rom_unwatch();
+
+#endif /* ROM_H */
@@ -0,0 +1,54 @@
+#ifndef SOUND_H
+#define SOUND_H
+
+/* Includes */
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "cpu.h"
+
+/* Macros */
+
+#define SAMPLE_RATE 44100 // Hz
+#define SAMPLES_PER_FRAME (SAMPLE_RATE / TIME_FREQUENCY)
+#define AUDIO_BUFFER_SAMPLES 256 // ~5.8ms at 44100Hz
+#define EDGE_RING_SIZE 256 // Must be a power of 2
+#define TONE_FREQUENCY 440 // Hz
+#define TONE_AMPLITUDE 4000
+#define RAMP_SAMPLES 64 // Fade in/out length, removes clicks on edges
+#define MAX_AHEAD_SAMPLES (4 * SAMPLES_PER_FRAME)
+#define CLOCK_SLEW 4 // Each frame the offset moves by 1/CLOCK_SLEW of its distance to the emulated clock
+#define PATTERN_BITS (8 * AUDIO_PATTERN_SIZE)
+#define PATTERN_BASE_RATE 4000.0 // Bits per second at pitch 64
+
+/* Structs */
+
+/**
+ * @brief A change of the buzzer state or of the XO-CHIP audio pattern, stamped with emulated time.
+ *
+ * @param stamp Emulated time of the change, counted in audio samples.
+ * @param on 1 if the buzzer is playing, 0 otherwise.
+ * @param pattern_loaded 1 to play the pattern, 0 to play the default tone.
+ * @param pitch Pattern playback pitch.
+ * @param pattern The 128 bits audio pattern.
+ */
+typedef struct {
+    uint64_t stamp;
+    uint8_t on;
+    uint8_t pattern_loaded;
+    uint8_t pitch;
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+} buzzer_edge;
+
+/* Functions */
+
+void initialize_sound();
+uint8_t open_wav(char* wav_path);
+void close_sound();
+void update_buzzer(uint64_t stamp);
+void mute_buzzer(uint64_t stamp);
+void sound_clock(uint64_t stamp);
+void render_sound(int16_t* samples, int count);
+void write_wav_frame();
+
+#endif /* SOUND_H */
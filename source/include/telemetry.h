@@ -0,0 +1,53 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+/* Includes */
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "display.h"
+
+/* Macros */
+
+#define HISTOGRAM_SUB_BITS 5 // 32 buckets per power of 2, values are known within 3%
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40 // Values are clamped to 2^40 ns, about 18 minutes
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+#define TELEMETRY_INTERVAL 1000 // ms between two reports
+#define TELEMETRY_EMULATE 0 // Interpreter time of a frame
+#define TELEMETRY_PRESENT 1 // Time in update_screen, the texture update and the present
+#define TELEMETRY_SLEEP 2 // Time slept past the FPS delay
+#define TELEMETRY_FRAME 3 // Time between the starts of two frames
+#define TELEMETRY_METRICS 4
+#define OVERLAY_LINES 5
+
+/* Structs */
+
+/**
+ * @brief Log-linear histogram of durations : the values below 2 * HISTOGRAM_SUB ns have their own bucket,
+ * each following power of 2 is split in HISTOGRAM_SUB buckets, so the relative error stays the same
+ * from a microsecond to a second.
+ *
+ * @param counts Number of values per bucket.
+ * @param total Number of values.
+ * @param max Largest value, in ns.
+ */
+typedef struct {
+    uint32_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} histogram;
+
+/* Functions */
+
+void histogram_record(histogram* h, uint64_t value);
+uint64_t histogram_percentile(histogram* h, double fraction);
+void histogram_merge(histogram* to, histogram* from);
+uint8_t telemetry_open(char* stats_path);
+void telemetry_record(uint8_t metric, Uint64 from, Uint64 to);
+void telemetry_frame(uint32_t executed, uint32_t counted);
+void telemetry_toggle();
+framebuffer* telemetry_overlay(framebuffer* fb);
+void telemetry_close();
+
+#endif /* TELEMETRY_H */
@@ -0,0 +1,27 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+/* Includes */
+
+#include <stdint.h>
+#include "cpu.h"
+
+/* Macros */
+
+#define TIMING_FRAME_CYCLES 3668 // Machine cycles of the 1.76 MHz COSMAC VIP in a 60 Hz frame (8 clocks each)
+#define TIMING_DISPLAY_CYCLES 1024 // Cycles taken by the display DMA, 8 bytes for each of the 128 lines
+#define TIMING_INTERRUPT_CYCLES 48 // Cycles of the display interrupt routine, timers included
+#define TIMING_BUDGET (TIMING_FRAME_CYCLES - TIMING_DISPLAY_CYCLES - TIMING_INTERRUPT_CYCLES)
+#define TIMING_FETCH 40 // Cycles of the interpreter loop fetching and dispatching an instruction
+#define TIMING_SKIP 4 // Extra cycles of a taken skip
+
+/* Functions */
+
+uint32_t instruction_cycles(uint16_t opcode);
+uint8_t timed_step();
+uint8_t timing_frame_done();
+uint32_t timing_cycles();
+void timing_next_frame();
+void timing_reset();
+
+#endif /* TIMING_H */
@@ -0,0 +1,109 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Includes */
+
+#include <stdint.h>
+#include <string.h>
+#include "cpu.h"
+
+/* Macros */
+
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 1
+#define TRACE_CHUNK_RECORDS 4096
+#define TRACE_CHUNKS 16 // Chunks in the ring of each thread
+#define TRACE_MASK_SIZE 2 // Bytes of the non zero bytes mask of a compressed record
+#define TRACE_COMPRESSED_CHUNK_SIZE (TRACE_CHUNK_RECORDS * (TRACE_MASK_SIZE + sizeof(trace_record))) // Largest compressed block
+
+/* Structs */
+
+/**
+ * @brief State of the CPU after one executed instruction, 16 bytes.
+ *
+ * @param PC Address of the executed instruction.
+ * @param opcode The executed opcode.
+ * @param I Value of I before the instruction.
+ * @param next_I Value of I after the instruction.
+ * @param vx Value of Vx after the instruction, x being the second nibble of the opcode.
+ * @param vy Value of Vy after the instruction, y being the third nibble of the opcode.
+ * @param vf Value of VF after the instruction.
+ * @param delay Delay timer after the instruction.
+ * @param sound_timer Sound timer after the instruction.
+ * @param stack_pointer Stack pointer after the instruction.
+ * @param reserved Padding, always 0.
+ */
+typedef struct {
+    uint16_t PC;
+    uint16_t opcode;
+    uint16_t I;
+    uint16_t next_I;
+    uint8_t vx, vy, vf;
+    uint8_t delay, sound_timer;
+    uint8_t stack_pointer;
+    uint8_t reserved[2];
+} trace_record;
+
+/**
+ * @brief Header of a block of compressed records in the trace file.
+ *
+ * Each record is XORed with the previous one of the block, then stored as a
+ * 16 bits mask of its non zero bytes followed by these bytes.
+ *
+ * @param thread Identifier of the recording thread.
+ * @param count Number of records in the block.
+ * @param size Size of the compressed data following the header.
+ */
+typedef struct {
+    uint32_t thread;
+    uint32_t count;
+    uint32_t size;
+} trace_block;
+
+/**
+ * @brief Position of a thread in the chunk it fills, owned by the ring of the thread.
+ *
+ * @param next Next record to fill.
+ * @param end End of the chunk, the chunk is published when next reaches it.
+ */
+typedef struct {
+    trace_record* next;
+    trace_record* end;
+} trace_cursor;
+
+/* Globals */
+
+extern uint8_t trace_enabled;
+extern THREAD_LOCAL trace_cursor* trace_position;
+
+/* Functions */
+
+uint8_t trace_open(char* trace_path);
+void trace_close();
+trace_cursor* trace_next_chunk();
+uint32_t trace_compress(trace_record* records, uint32_t count, uint8_t* out);
+uint32_t trace_decompress(uint8_t* data, uint32_t size, uint32_t count, trace_record* records);
+
+/**
+ * @brief Record the state after an executed instruction in the ring of the calling thread. Inlined in step(),
+ * a call for each instruction cost more than the stores.
+ *
+ * @param PC Address of the instruction.
+ * @param opcode The executed opcode.
+ * @param I Value of I before the instruction.
+ */
+static inline void trace_step(uint16_t PC, uint16_t opcode, uint16_t I){
+    trace_cursor* cursor = trace_position;
+    uint64_t words[2];
+
+    if (cursor == NULL || cursor->next == cursor->end){
+        cursor = trace_next_chunk();
+    }
+    // Two words in the field order of trace_record on a little endian host
+    words[0] = PC | (uint32_t) opcode << 16 | (uint64_t) I << 32 | (uint64_t) CPU.I << 48;
+    words[1] = CPU.V[(opcode >> 8) & 0xF] | (uint32_t) CPU.V[(opcode >> 4) & 0xF] << 8 | (uint32_t) CPU.V[0xF] << 16
+        | (uint32_t) CPU.delay << 24 | (uint64_t) CPU.sound_timer << 32 | (uint64_t) CPU.stack_pointer << 40;
+    memcpy(cursor->next++, words, sizeof(words));
+}
+
+#endif /* TRACE_H */
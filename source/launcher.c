@@ -0,0 +1,249 @@
+/**
+ * @file launcher.c
+ * @author Xavier Monard
+ * @brief ROM picker : the ROMs of a directory are read in memory and shown as a grid of thumbnails,
+ * made by a background thread running each ROM headless on its own machine. Starting a ROM
+ * copies it in the machine of the emulator, the window stays open.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include "include/launcher.h"
+#include "include/cpu.h"
+
+static launcher_rom* roms = NULL;
+static uint32_t rom_count = 0;
+static int selected = 0;
+static uint8_t shown = 0;
+static SDL_Thread* thumbnailer = NULL;
+static SDL_atomic_t stopping;
+static framebuffer screen;
+
+/* Order of the ROM names. */
+static int compare_names(const void* a, const void* b){
+    return strcmp(((const launcher_rom*) a)->name, ((const launcher_rom*) b)->name);
+}
+
+/**
+ * @brief Reduce a screen to a thumbnail, a thumbnail pixel is lit when a pixel of its block is lit in a plane.
+ *
+ * @param fb The screen.
+ * @param thumbnail Receives THUMBNAIL_HEIGTH rows.
+ */
+static void reduce(framebuffer* fb, uint32_t* thumbnail){
+    uint8_t scale = (fb->hires ? SCREEN_WIDTH : LORES_WIDTH) / THUMBNAIL_WIDTH;
+
+    for (uint8_t ty = 0; ty < THUMBNAIL_HEIGTH; ty++){
+        uint32_t row = 0;
+        for (uint8_t tx = 0; tx < THUMBNAIL_WIDTH; tx++){
+            uint64_t lit = 0;
+            for (uint8_t y = ty * scale; y < (ty + 1) * scale; y++){
+                for (uint8_t x = tx * scale; x < (tx + 1) * scale; x++){
+                    lit |= (fb->rows[0][y][x >> 6] | fb->rows[1][y][x >> 6]) >> (63 - (x & 63));
+                }
+            }
+            row |= (uint32_t) (lit & 1) << (31 - tx);
+        }
+        thumbnail[ty] = row;
+    }
+}
+
+/* Thread running every ROM on its own machine, without keys, to take its thumbnail. It bypasses step() so that
+   the thumbnails are never recorded in the trace of the game. */
+static int thumbnail_main(void* data){
+    cpu* machine = malloc(sizeof(cpu));
+    (void) data;
+
+    if (machine == NULL){
+        return 1;
+    }
+    cpu_context = machine;
+    for (uint32_t k = 0; k < rom_count && SDL_AtomicGet(&stopping) == 0; k++){
+        uint8_t keep_up = 1;
+
+        initialize();
+        memcpy(&CPU.ram[READ_AREA], roms[k].data, roms[k].size);
+        for (uint32_t frame = 0; frame < LAUNCHER_FRAMES && keep_up == 1; frame++){
+            for (int actions = 0; actions < CPU_SPEED && keep_up == 1; actions++){
+                keep_up = interpret_opcode(get_opcode());
+            }
+            time_count();
+        }
+        reduce(&CPU.screen, roms[k].thumbnail);
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet(&roms[k].ready, 1);
+    }
+    free(machine);
+    return 0;
+}
+
+/**
+ * @brief Read the ROMs of a directory in memory, their thumbnails are made once the launcher is first shown.
+ *
+ * @param directory The directory of the ROMs.
+ * @return uint32_t Number of ROMs, 0 if the directory has none or cannot be read.
+ */
+uint32_t launcher_open(char* directory){
+    static uint8_t data[ROM_MAX_SIZE];
+    DIR* listing = opendir(directory);
+    struct dirent* entry;
+
+    if (listing == NULL){
+        return 0;
+    }
+    roms = calloc(LAUNCHER_MAX_ROMS, sizeof(launcher_rom));
+    if (roms == NULL){
+        closedir(listing);
+        return 0;
+    }
+    while ((entry = readdir(listing)) != NULL && rom_count < LAUNCHER_MAX_ROMS){
+        launcher_rom* rom = &roms[rom_count];
+        if (entry->d_name[0] == '.'){
+            continue;
+        }
+        snprintf(rom->name, sizeof(rom->name), "%s", entry->d_name);
+        snprintf(rom->path, sizeof(rom->path), "%s/%s", directory, entry->d_name);
+        rom->size = read_rom(rom->path, data);
+        rom->data = rom->size > 0 ? malloc(rom->size) : NULL;
+        if (rom->data != NULL){
+            memcpy(rom->data, data, rom->size);
+            rom_count++;
+        }
+    }
+    closedir(listing);
+    qsort(roms, rom_count, sizeof(launcher_rom), compare_names);
+
+    SDL_AtomicSet(&stopping, 0);
+    return rom_count;
+}
+
+/* Name the selected ROM in the window title, the hex font cannot write it. */
+static void show_selection(){
+    char title[LAUNCHER_NAME_SIZE + 64];
+
+    snprintf(title, sizeof(title), "Chip8 Emulator - %s (%d/%u)", roms[selected].name, selected + 1, rom_count);
+    SDL_SetWindowTitle(sdl_window, title);
+}
+
+/* Show the launcher over the running game, the thumbnail thread starts the first time. */
+void launcher_show(){
+    if (rom_count > 0){
+        if (thumbnailer == NULL){
+            thumbnailer = SDL_CreateThread(thumbnail_main, "thumbnails", NULL);
+        }
+        shown = 1;
+        show_selection();
+    }
+}
+
+/* Hide the launcher, the title names the ROM that runs. */
+void launcher_hide(){
+    char title[LAUNCHER_NAME_SIZE + 64];
+
+    shown = 0;
+    if (rom_count > 0){
+        snprintf(title, sizeof(title), "Chip8 Emulator - %s", roms[selected].name);
+        SDL_SetWindowTitle(sdl_window, title);
+    }
+}
+
+/**
+ * @brief Tell if the launcher is shown.
+ *
+ * @return uint8_t 1 while the launcher is shown.
+ */
+uint8_t launcher_shown(){
+    return shown;
+}
+
+/**
+ * @brief Move the selection with the arrows, Enter picks the selected ROM. Keys are ignored while the launcher is hidden.
+ *
+ * @param key The key pressed.
+ * @return int Index of the ROM to start, LAUNCHER_NONE otherwise.
+ */
+int launcher_key(SDL_Keycode key){
+    int previous = selected;
+
+    if (shown == 0){
+        return LAUNCHER_NONE;
+    }
+    switch (key){
+        case SDLK_LEFT: { selected--; break;}
+        case SDLK_RIGHT: { selected++; break;}
+        case SDLK_UP: { selected -= LAUNCHER_COLUMNS; break;}
+        case SDLK_DOWN: { selected += LAUNCHER_COLUMNS; break;}
+        case SDLK_RETURN: { return selected;}
+        default: {break;}
+    }
+    if (selected < 0 || selected >= (int) rom_count){
+        selected = previous;
+    }
+    if (selected != previous){
+        show_selection();
+    }
+    return LAUNCHER_NONE;
+}
+
+/**
+ * @brief A ROM of the launcher.
+ *
+ * @param index Its index, from launcher_key().
+ * @return launcher_rom* The ROM.
+ */
+launcher_rom* launcher_get(int index){
+    return &roms[index];
+}
+
+/**
+ * @brief The page of thumbnails holding the selected ROM, the selected cell lit in the second plane.
+ *
+ * @return framebuffer* The screen of the launcher, in high resolution.
+ */
+framebuffer* launcher_screen(){
+    int first = selected - selected % (LAUNCHER_COLUMNS * LAUNCHER_ROWS);
+
+    memset(&screen, 0, sizeof(screen));
+    screen.hires = 1;
+    for (int cell = 0; cell < LAUNCHER_COLUMNS * LAUNCHER_ROWS && first + cell < (int) rom_count; cell++){
+        launcher_rom* rom = &roms[first + cell];
+        uint8_t x = (cell % LAUNCHER_COLUMNS) * THUMBNAIL_WIDTH;
+        uint8_t y = (cell / LAUNCHER_COLUMNS) * THUMBNAIL_HEIGTH;
+        uint8_t shift = 64 - THUMBNAIL_WIDTH - (x & 63);
+        uint8_t ready = SDL_AtomicGet(&rom->ready) == 1;
+
+        SDL_MemoryBarrierAcquire();
+        for (uint8_t row = 0; row < THUMBNAIL_HEIGTH; row++){
+            // The last row and column of a cell separate it from the next ones
+            if (ready && row < THUMBNAIL_HEIGTH - 1){
+                screen.rows[0][y + row][x >> 6] |= (uint64_t) (rom->thumbnail[row] & ~1u) << shift;
+            }
+            if (first + cell == selected){
+                screen.rows[1][y + row][x >> 6] |= (uint64_t) 0xFFFFFFFF << shift;
+            }
+        }
+    }
+    return &screen;
+}
+
+/* Stop the thumbnail thread and free the ROMs. */
+void launcher_close(){
+    if (thumbnailer != NULL){
+        SDL_AtomicSet(&stopping, 1);
+        SDL_WaitThread(thumbnailer, NULL);
+        thumbnailer = NULL;
+    }
+    for (uint32_t k = 0; k < rom_count; k++){
+        free(roms[k].data);
+    }
+    free(roms);
+    roms = NULL;
+    rom_count = 0;
+}
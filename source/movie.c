@@ -0,0 +1,111 @@
+/**
+ * @file movie.c
+ * @author Xavier Monard
+ * @brief Key movies and state hashes shared by the headless tools. A movie holds the key of each frame,
+ * NO_KEY for none, and is stored as a character per frame : '.' for no key, 0 to F for a key held.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <string.h>
+#include "include/movie.h"
+#include "include/cpu.h"
+
+/**
+ * @brief Character of a frame in a movie file.
+ *
+ * @param key The key held, NO_KEY for none.
+ * @return char '.' or the hexadecimal digit of the key.
+ */
+char movie_key(uint8_t key){
+    return key == NO_KEY ? '.' : "0123456789ABCDEF"[key & 0xF];
+}
+
+/**
+ * @brief Read a movie, the characters other than '.' and the hexadecimal digits are ignored.
+ *
+ * @param file The movie file.
+ * @param keys The key of each frame.
+ * @param size Most frames read.
+ * @return uint32_t Number of frames read.
+ */
+uint32_t read_movie(FILE* file, uint8_t* keys, uint32_t size){
+    uint32_t frames = 0;
+    int c;
+
+    while ((c = fgetc(file)) != EOF && frames < size){
+        if (c == '.'){
+            keys[frames++] = NO_KEY;
+        }
+        else if (c >= '0' && c <= '9'){
+            keys[frames++] = c - '0';
+        }
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f'){
+            keys[frames++] = (c | 0x20) - 'a' + 10;
+        }
+    }
+    return frames;
+}
+
+/**
+ * @brief Write a movie, MOVIE_LINE frames per line.
+ *
+ * @param file The movie file.
+ * @param keys The key of each frame.
+ * @param frames Number of frames.
+ */
+void write_movie(FILE* file, const uint8_t* keys, uint32_t frames){
+    for (uint32_t f = 0; f < frames; f++){
+        fputc(movie_key(keys[f]), file);
+        if (f % MOVIE_LINE == MOVIE_LINE - 1){
+            fputc('\n', file);
+        }
+    }
+    fputc('\n', file);
+}
+
+/**
+ * @brief Draw a movie : keys held a random number of frames, up to MOVIE_HOLD, and frames without keys.
+ *
+ * @param keys The key of each frame.
+ * @param frames Number of frames.
+ * @param seed Seed of the generator, the same seed gives the same movie.
+ */
+void generate_movie(uint8_t* keys, uint32_t frames, uint32_t seed){
+    uint32_t state = seed | 1;
+
+    for (uint32_t f = 0; f < frames;){
+        uint8_t key = random_byte(&state) % (NB_KEYS + 1);
+        uint32_t length = 1 + random_byte(&state) % MOVIE_HOLD;
+        for (; length > 0 && f < frames; length--){
+            keys[f++] = key == NB_KEYS ? NO_KEY : key;
+        }
+    }
+}
+
+/**
+ * @brief Mix bytes in a hash, 8 at a time. Start from HASH_SEED.
+ *
+ * @param hash The hash of the previous bytes.
+ * @param data The bytes.
+ * @param size Number of bytes.
+ * @return uint64_t The new hash.
+ */
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size){
+    const uint8_t* bytes = data;
+    uint64_t word;
+    size_t k = 0;
+
+    for (; k + sizeof(word) <= size; k += sizeof(word)){
+        memcpy(&word, bytes + k, sizeof(word));
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+    for (; k < size; k++){
+        hash = (hash ^ bytes[k]) * 0xFF51AFD7ED558CCDULL;
+    }
+    return hash;
+}
@@ -0,0 +1,319 @@
+/**
+ * @file regress.c
+ * @author Xavier Monard
+ * @brief Regression suite : runs every ROM headless with its recorded key script, hashes the
+ * framebuffer at chosen frames and compares the hashes with the stored goldens. The ROMs are
+ * shared between a few threads. A frame not matching its golden is written as a PBM image.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "include/regress.h"
+#include "include/display.h"
+
+static const uint32_t default_checkpoints[] = {30, 60, 120, 240, 480, 900, 1200, 1800};
+
+static regression* suite = NULL;
+static uint32_t suite_size = 0;
+static SDL_atomic_t next_rom;
+static char* rom_directory = REGRESS_ROMS;
+static char* golden_directory = REGRESS_DIR;
+static char* out_directory = REGRESS_OUT;
+static uint8_t update = 0;
+
+/* Hash of the visible state of a framebuffer : its mode and both planes. */
+static uint64_t framebuffer_hash(framebuffer* fb){
+    uint64_t hash = 0xCBF29CE484222325ULL ^ fb->hires;
+
+    for (uint8_t p = 0; p < PLANES; p++){
+        for (uint8_t y = 0; y < SCREEN_HEIGTH; y++){
+            for (uint8_t w = 0; w < ROW_WORDS; w++){
+                hash = (hash ^ fb->rows[p][y][w]) * 0x100000001B3ULL;
+                hash ^= hash >> 29;
+            }
+        }
+    }
+    return hash;
+}
+
+/* Names of the files of a ROM. */
+static void path(char* text, size_t size, const char* directory, const char* name, const char* extension){
+    snprintf(text, size, "%s/%s%s", directory, name, extension);
+}
+
+/**
+ * @brief Read the key script of a ROM, a character per frame. Without a script, one is drawn at random when recording.
+ *
+ * @param r The ROM.
+ * @return uint8_t 0 if the script is missing.
+ */
+static uint8_t read_script(regression* r){
+    char name[2 * REGRESS_NAME_SIZE];
+    FILE* file;
+
+    path(name, sizeof(name), golden_directory, r->name, ".keys");
+    file = fopen(name, "r");
+    if (file == NULL){
+        uint32_t seed = RNG_SEED;
+        // The seed depends on the name, so that ROMs get different scripts
+        for (char* letter = r->name; *letter; letter++){
+            seed = seed * 31 + *letter;
+        }
+        r->frames = REGRESS_FRAMES;
+        generate_movie(r->keys, r->frames, seed);
+        return 0;
+    }
+    r->frames = read_movie(file, r->keys, REGRESS_FRAMES);
+    fclose(file);
+    return 1;
+}
+
+/**
+ * @brief Read the golden of a ROM, a "frame hash" line per checkpoint, '#' starting comments.
+ *
+ * @param r The ROM.
+ * @return uint8_t 0 if the golden is missing.
+ */
+static uint8_t read_golden(regression* r){
+    char name[2 * REGRESS_NAME_SIZE];
+    char line[REGRESS_NAME_SIZE];
+    FILE* file;
+
+    path(name, sizeof(name), golden_directory, r->name, ".golden");
+    file = fopen(name, "r");
+    r->count = 0;
+    if (file == NULL){
+        for (; r->count < sizeof(default_checkpoints) / sizeof(default_checkpoints[0]); r->count++){
+            r->checkpoints[r->count] = default_checkpoints[r->count];
+        }
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file) != NULL && r->count < REGRESS_CHECKPOINTS){
+        unsigned long frame;
+        unsigned long long hash;
+        if (line[0] != '#' && sscanf(line, "%lu %llx", &frame, &hash) == 2){
+            r->checkpoints[r->count] = frame;
+            r->expected[r->count] = hash;
+            r->count++;
+        }
+    }
+    fclose(file);
+    return 1;
+}
+
+/* Store the script and the hashes of this run as the new golden. */
+static void write_golden(regression* r){
+    char name[2 * REGRESS_NAME_SIZE];
+    FILE* file;
+
+    path(name, sizeof(name), golden_directory, r->name, ".keys");
+    file = fopen(name, "w");
+    if (file != NULL){
+        write_movie(file, r->keys, r->frames);
+        fclose(file);
+    }
+    path(name, sizeof(name), golden_directory, r->name, ".golden");
+    file = fopen(name, "w");
+    if (file == NULL){
+        fprintf(stderr, "Unable to write %s.\n", name);
+        return;
+    }
+    fprintf(file, "# frame hash of %s with %s.keys\n", r->name, r->name);
+    for (uint32_t k = 0; k < r->count; k++){
+        fprintf(file, "%u %016llx\n", r->checkpoints[k], (unsigned long long) r->actual[k]);
+    }
+    fclose(file);
+}
+
+/* Write the framebuffer of a checkpoint not matching its golden. */
+static void write_failure(regression* r, uint32_t frame){
+    char name[2 * REGRESS_NAME_SIZE];
+    char suffix[32];
+    FILE* file;
+
+    snprintf(suffix, sizeof(suffix), "-%u.pbm", frame);
+    path(name, sizeof(name), out_directory, r->name, suffix);
+    file = fopen(name, "wb");
+    if (file != NULL){
+        write_pbm(file, &CPU.screen);
+        fclose(file);
+    }
+}
+
+/**
+ * @brief Run a ROM with its script on the machine of the thread, checking each checkpoint.
+ *
+ * @param r The ROM.
+ */
+static void run(regression* r){
+    char name[2 * REGRESS_NAME_SIZE];
+    uint8_t held = NO_KEY;
+    uint32_t checkpoint = 0;
+    uint32_t last = r->count > 0 ? r->checkpoints[r->count - 1] : 0;
+
+    initialize();
+    path(name, sizeof(name), rom_directory, r->name, "");
+    load_game(name);
+
+    r->failed = r->count;
+    for (uint32_t frame = 1; frame <= last; frame++){
+        uint8_t key = frame - 1 < r->frames ? r->keys[frame - 1] : NO_KEY;
+        if (key != held){
+            if (held != NO_KEY){
+                set_key(held, KEY_UNPRESSED);
+            }
+            if (key != NO_KEY){
+                set_key(key, KEY_PRESSED);
+            }
+            held = key;
+        }
+        for (int actions = 0; actions < CPU_SPEED && r->exited == 0; actions++){
+            r->exited = step() == 0;
+        }
+        time_count();
+
+        // The screen of a game which exited stays as it was
+        while (checkpoint < r->count && r->checkpoints[checkpoint] == frame){
+            r->actual[checkpoint] = framebuffer_hash(&CPU.screen);
+            if (update == 0 && r->actual[checkpoint] != r->expected[checkpoint]){
+                if (r->failed == r->count){
+                    r->failed = checkpoint;
+                }
+                write_failure(r, frame);
+            }
+            checkpoint++;
+        }
+    }
+}
+
+/* Thread running ROMs of the suite until all are done. */
+static int worker(void* data){
+    cpu* machine = malloc(sizeof(cpu));
+    (void) data;
+
+    if (machine == NULL){
+        return 1;
+    }
+    cpu_context = machine;
+    for (;;){
+        int k = SDL_AtomicAdd(&next_rom, 1);
+        if (k >= (int) suite_size){
+            break;
+        }
+        run(&suite[k]);
+    }
+    free(machine);
+    return 0;
+}
+
+/* Order of the ROM names. */
+static int compare_names(const void* a, const void* b){
+    return strcmp(((const regression*) a)->name, ((const regression*) b)->name);
+}
+
+int main(int argc, char* argv[]){
+    int threads = REGRESS_THREADS;
+    uint32_t missing = 0, failures = 0;
+
+    suite = calloc(REGRESS_MAX_ROMS, sizeof(regression));
+    if (suite == NULL){
+        fprintf(stderr, "Unable to allocate the suite.\n");
+        return EXIT_FAILURE;
+    }
+    for (int k = 1; k < argc; k++){
+        if (strcmp(argv[k], "--update") == 0){
+            update = 1;
+        }
+        else if (strcmp(argv[k], "--threads") == 0 && k + 1 < argc){
+            threads = atoi(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--roms") == 0 && k + 1 < argc){
+            rom_directory = argv[++k];
+        }
+        else if (strcmp(argv[k], "--golden") == 0 && k + 1 < argc){
+            golden_directory = argv[++k];
+        }
+        else if (strcmp(argv[k], "--out") == 0 && k + 1 < argc){
+            out_directory = argv[++k];
+        }
+        else if (suite_size < REGRESS_MAX_ROMS && argv[k][0] != '-'){
+            // Only the given ROMs of the directory
+            snprintf(suite[suite_size++].name, REGRESS_NAME_SIZE, "%s", argv[k]);
+        }
+        else {
+            printf("Usage : %s [--update] [--threads <n>] [--roms <directory>] [--golden <directory>] [--out <directory>] [rom names]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (threads < 1){
+        threads = 1;
+    }
+
+    if (suite_size == 0){
+        DIR* directory = opendir(rom_directory);
+        struct dirent* entry;
+        if (directory == NULL){
+            fprintf(stderr, "Unable to open %s.\n", rom_directory);
+            return EXIT_FAILURE;
+        }
+        while ((entry = readdir(directory)) != NULL && suite_size < REGRESS_MAX_ROMS){
+            if (entry->d_name[0] != '.'){
+                snprintf(suite[suite_size++].name, REGRESS_NAME_SIZE, "%s", entry->d_name);
+            }
+        }
+        closedir(directory);
+        qsort(suite, suite_size, sizeof(regression), compare_names);
+    }
+    for (uint32_t k = 0; k < suite_size; k++){
+        uint8_t recorded = read_script(&suite[k]);
+        if (read_golden(&suite[k]) == 0 || recorded == 0){
+            if (update == 0){
+                printf("%-12s no golden, record it with --update\n", suite[k].name);
+                suite[k].count = 0;
+                missing++;
+            }
+        }
+    }
+    if (update == 0){
+        mkdir(out_directory, 0755);
+    }
+
+    Uint64 timer = SDL_GetPerformanceCounter();
+    SDL_Thread* handles[REGRESS_MAX_ROMS];
+    threads = threads < (int) suite_size ? threads : (int) suite_size;
+    SDL_AtomicSet(&next_rom, 0);
+    for (int k = 0; k < threads; k++){
+        handles[k] = SDL_CreateThread(worker, "regress", NULL);
+    }
+    for (int k = 0; k < threads; k++){
+        SDL_WaitThread(handles[k], NULL);
+    }
+    double seconds = (double) (SDL_GetPerformanceCounter() - timer) / SDL_GetPerformanceFrequency();
+
+    for (uint32_t k = 0; k < suite_size; k++){
+        regression* r = &suite[k];
+        if (update){
+            write_golden(r);
+            printf("%-12s recorded %u checkpoints%s\n", r->name, r->count, r->exited ? " (exited)" : "");
+        }
+        else if (r->failed < r->count){
+            failures++;
+            printf("%-12s FAILED at frame %u, see %s/%s-%u.pbm\n", r->name, r->checkpoints[r->failed], out_directory, r->name,
+                   r->checkpoints[r->failed]);
+        }
+        else if (r->count > 0){
+            printf("%-12s ok\n", r->name);
+        }
+    }
+    printf("%u roms, %u failed, %u without golden, %.2fs with %d threads\n", suite_size, failures, missing, seconds, threads);
+    free(suite);
+    return failures == 0 && missing == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
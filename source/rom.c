@@ -0,0 +1,139 @@
+/**
+ * @file rom.c
+ * @author Xavier Monard
+ * @brief Loading of ROMs in the running machine and hot reload : an inotify watch on the directory of the ROM
+ * tells when it was written, the changed bytes are then applied to memory without restarting SDL.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "include/rom.h"
+
+/* The ROM in memory, as it was loaded, to find the bytes changed by the next one. */
+static uint8_t loaded[ROM_MAX_SIZE];
+static uint32_t loaded_size = 0;
+
+static int watch_fd = -1;
+static char watched_name[FILENAME_MAX];
+
+/**
+ * @brief Read a ROM file.
+ *
+ * @param path Path of the ROM.
+ * @param data Receives the ROM, ROM_MAX_SIZE bytes.
+ * @return uint32_t Size of the ROM, 0 if it cannot be read or is empty.
+ */
+uint32_t read_rom(char* path, uint8_t* data){
+    FILE* rom = fopen(path, "rb");
+    size_t size;
+
+    if (rom == NULL){
+        return 0;
+    }
+    size = fread(data, 1, ROM_MAX_SIZE, rom);
+    fclose(rom);
+    return (uint32_t) size;
+}
+
+/**
+ * @brief Put a ROM in the machine of the thread. The interpreter fetches every opcode from memory and keeps
+ * no decoded code, so the written bytes take effect at the next instruction.
+ *
+ * @param data The ROM, from a file or from memory.
+ * @param size Its size, at most ROM_MAX_SIZE.
+ * @param mode ROM_RESET to restart the machine, ROM_PRESERVE to only write the bytes differing from the last ROM.
+ * @return uint32_t Number of bytes written in memory.
+ */
+uint32_t apply_rom(uint8_t* data, uint32_t size, uint8_t mode){
+    uint32_t changed = 0;
+
+    size = size < ROM_MAX_SIZE ? size : ROM_MAX_SIZE;
+    if (mode == ROM_RESET){
+        initialize();
+        memcpy(&CPU.ram[READ_AREA], data, size);
+        changed = size;
+    }
+    else {
+        // The bytes the previous ROM had past the end of the new one are cleared
+        uint32_t end = size > loaded_size ? size : loaded_size;
+        for (uint32_t k = 0; k < end; k++){
+            uint8_t byte = k < size ? data[k] : 0;
+            if (byte != (k < loaded_size ? loaded[k] : 0)){
+                CPU.ram[READ_AREA + k] = byte;
+                changed++;
+            }
+        }
+    }
+    memcpy(loaded, data, size);
+    loaded_size = size;
+    return changed;
+}
+
+/**
+ * @brief Watch a ROM file. The directory is watched rather than the file, editors often save by
+ * writing a new file and renaming it over the old one.
+ *
+ * @param path Path of the ROM.
+ * @return uint8_t 1 on success, 0 otherwise.
+ */
+uint8_t rom_watch(char* path){
+    char directory[FILENAME_MAX];
+    char* slash = strrchr(path, '/');
+
+    if (slash == NULL){
+        snprintf(directory, sizeof(directory), ".");
+        snprintf(watched_name, sizeof(watched_name), "%s", path);
+    }
+    else {
+        snprintf(directory, sizeof(directory), "%.*s", slash == path ? 1 : (int) (slash - path), path);
+        snprintf(watched_name, sizeof(watched_name), "%s", slash + 1);
+    }
+
+    watch_fd = inotify_init1(IN_NONBLOCK);
+    if (watch_fd < 0 || inotify_add_watch(watch_fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0){
+        fprintf(stderr, "Unable to watch %s\n", directory);
+        rom_unwatch();
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Read the pending events of the watch, without waiting.
+ *
+ * @return uint8_t 1 if the ROM was written or replaced since the last call.
+ */
+uint8_t rom_changed(){
+    char events[ROM_EVENTS_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    uint8_t changed = 0;
+    ssize_t length;
+
+    if (watch_fd < 0){
+        return 0;
+    }
+    while ((length = read(watch_fd, events, sizeof(events))) > 0){
+        for (char* next = events; next < events + length;){
+            struct inotify_event* event = (struct inotify_event*) next;
+            if (event->len > 0 && strcmp(event->name, watched_name) == 0){
+                changed = 1;
+            }
+            next += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+/* Stop watching the ROM. */
+void rom_unwatch(){
+    if (watch_fd >= 0){
+        close(watch_fd);
+        watch_fd = -1;
+    }
+}
@@ -0,0 +1,311 @@
+/**
+ * @file sound.c
+ * @author Xavier Monard
+ * @brief Beeper driven by the sound timer. The emulation loop pushes buzzer
+ * on/off edges stamped with emulated time into a lock-free ring, the SDL audio
+ * callback (or the headless WAV writer) plays a square tone between them.
+ * @version 0.1
+ * @date 2023-06-01
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+#include "include/sound.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* Edge ring, written by the emulation thread and read by the audio thread */
+static buzzer_edge edge_ring[EDGE_RING_SIZE];
+static SDL_atomic_t ring_head; // Next slot to write
+static SDL_atomic_t ring_tail; // Next slot to read
+static SDL_atomic_t emulated_clock; // Low 32 bits of the emulated time at the start of the last frame
+static buzzer_edge pushed = {0, 0, 0, DEFAULT_PITCH, {0}};
+
+/* Consumer state, only touched by the audio callback or the WAV writer */
+static uint64_t position = 0; // Audio time in samples
+static int64_t offset = 0; // Audio time - emulated time
+static uint8_t synced = 0;
+static uint32_t seen_clock = 0;
+static uint32_t latency = AUDIO_BUFFER_SAMPLES;
+static buzzer_edge current = {0, 0, 0, DEFAULT_PITCH, {0}};
+static uint32_t envelope = 0;
+static uint32_t phase = 0;
+static uint32_t pattern_phase = 0; // Position in the pattern, 16.16 fixed point bits
+static uint32_t pattern_step = 0; // Bits per sample, 16.16 fixed point
+
+static SDL_AudioDeviceID audio_device = 0;
+static FILE* wav_file = NULL;
+static uint32_t wav_samples = 0;
+
+/**
+ * @brief Feed the audio device, called by SDL from its own thread.
+ *
+ * @param userdata Unused.
+ * @param stream Buffer to fill with signed 16 bits samples.
+ * @param len Size of the buffer in bytes.
+ */
+static void audio_callback(void* userdata, Uint8* stream, int len){
+    (void) userdata;
+    render_sound((int16_t*) stream, len / (int) sizeof(int16_t));
+}
+
+/**
+ * @brief Open the audio device. The emulator keeps running silently if it fails.
+ *
+ */
+void initialize_sound(){
+    SDL_AudioSpec wanted;
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) == -1){
+        fprintf(stderr, "Unable to launch SDL audio, sound is disabled :\n %s\n", SDL_GetError());
+        return;
+    }
+    memset(&wanted, 0, sizeof(wanted));
+    wanted.freq = SAMPLE_RATE;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 1;
+    wanted.samples = AUDIO_BUFFER_SAMPLES;
+    wanted.callback = audio_callback;
+
+    audio_device = SDL_OpenAudioDevice(NULL, 0, &wanted, NULL, 0);
+    if (audio_device == 0){
+        fprintf(stderr, "Unable to open the audio device, sound is disabled :\n %s\n", SDL_GetError());
+        return;
+    }
+    SDL_PauseAudioDevice(audio_device, 0);
+}
+
+/**
+ * @brief Write a little endian value of size bytes in the WAV file.
+ *
+ */
+static void write_le(uint32_t value, uint8_t size){
+    for (uint8_t k = 0; k < size; k++){
+        fputc((value >> (8 * k)) & 0xFF, wav_file);
+    }
+}
+
+/**
+ * @brief Headless mode : the audio stream is written to a WAV file instead of the audio device.
+ *
+ * @param wav_path Path of the WAV file to create.
+ * @return uint8_t 1 on success, 0 otherwise.
+ */
+uint8_t open_wav(char* wav_path){
+    wav_file = fopen(wav_path, "wb");
+    if (wav_file == NULL){
+        fprintf(stderr, "Unable to create the WAV file %s\n", wav_path);
+        return 0;
+    }
+    // RIFF header, sizes are patched in close_sound()
+    fwrite("RIFF", 1, 4, wav_file);
+    write_le(0, 4);
+    fwrite("WAVEfmt ", 1, 8, wav_file);
+    write_le(16, 4);
+    write_le(1, 2); // PCM
+    write_le(1, 2); // Mono
+    write_le(SAMPLE_RATE, 4);
+    write_le(SAMPLE_RATE * sizeof(int16_t), 4);
+    write_le(sizeof(int16_t), 2);
+    write_le(16, 2);
+    fwrite("data", 1, 4, wav_file);
+    write_le(0, 4);
+
+    // Emulated time is the audio time
+    latency = 0;
+    synced = 1;
+    return 1;
+}
+
+/**
+ * @brief Close the audio device and finalize the WAV file.
+ *
+ */
+void close_sound(){
+    if (audio_device != 0){
+        SDL_CloseAudioDevice(audio_device);
+        audio_device = 0;
+    }
+    if (wav_file != NULL){
+        fseek(wav_file, 4, SEEK_SET);
+        write_le(36 + wav_samples * sizeof(int16_t), 4);
+        fseek(wav_file, 40, SEEK_SET);
+        write_le(wav_samples * sizeof(int16_t), 4);
+        fclose(wav_file);
+        wav_file = NULL;
+    }
+}
+
+/**
+ * @brief Queue an edge when the buzzer state or the audio pattern changed.
+ *
+ * If the ring is full the edge is retried on the next call, so the last state always reaches the consumer.
+ *
+ * @param stamp Emulated time of the state, in samples.
+ * @param on 1 while the buzzer sounds.
+ */
+static void push_state(uint64_t stamp, uint8_t on){
+    if (on == pushed.on && CPU.pattern_loaded == pushed.pattern_loaded && CPU.pitch == pushed.pitch
+        && (CPU.pattern_loaded == 0 || memcmp(CPU.pattern, pushed.pattern, AUDIO_PATTERN_SIZE) == 0)){
+        return;
+    }
+    unsigned head = (unsigned) SDL_AtomicGet(&ring_head);
+    unsigned tail = (unsigned) SDL_AtomicGet(&ring_tail);
+    if (head - tail >= EDGE_RING_SIZE){
+        return;
+    }
+    pushed.stamp = stamp;
+    pushed.on = on;
+    pushed.pattern_loaded = CPU.pattern_loaded;
+    pushed.pitch = CPU.pitch;
+    memcpy(pushed.pattern, CPU.pattern, AUDIO_PATTERN_SIZE);
+
+    edge_ring[head & (EDGE_RING_SIZE - 1)] = pushed;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&ring_head, (int) (head + 1));
+}
+
+/**
+ * @brief Report the buzzer state and the audio pattern, an edge is queued only when one of them changes.
+ *
+ * @param stamp Emulated time of the state, in samples.
+ */
+void update_buzzer(uint64_t stamp){
+    push_state(stamp, CPU.sound_timer > 0);
+}
+
+/**
+ * @brief Stop the buzzer while the machine does not run, the next update_buzzer() restores its state.
+ *
+ * @param stamp Emulated time of the edge, in samples.
+ */
+void mute_buzzer(uint64_t stamp){
+    push_state(stamp, 0);
+}
+
+/**
+ * @brief Publish the emulated time at the start of a frame, the audio thread follows it to keep the offset.
+ *
+ * @param stamp Emulated time of the frame, in samples.
+ */
+void sound_clock(uint64_t stamp){
+    SDL_AtomicSet(&emulated_clock, (int) (uint32_t) stamp);
+}
+
+/**
+ * @brief Move the offset toward the emulated clock. The frames of the emulator do not last exactly
+ * SAMPLES_PER_FRAME samples of audio, without it the edges would slowly drift ahead of the audio.
+ * Only the low 32 bits of the times are compared, the distance is always far below 2^31 samples.
+ */
+static void follow_clock(){
+    uint32_t now = (uint32_t) SDL_AtomicGet(&emulated_clock);
+    int32_t distance;
+
+    if (now == seen_clock){
+        return;
+    }
+    seen_clock = now;
+    distance = (int32_t) ((uint32_t) (position + latency) - now - (uint32_t) offset);
+    if (synced == 0){
+        offset += distance;
+        synced = 1;
+    }
+    else {
+        offset += distance / CLOCK_SLEW;
+    }
+}
+
+/**
+ * @brief Apply every edge that is due at the current audio position.
+ *
+ * Emulated time is mapped to audio time with an offset following the emulated clock. Edges arriving late,
+ * or too far ahead like in turbo mode, move the offset instead of being delayed or queued forever.
+ */
+static void consume_edges(){
+    unsigned tail = (unsigned) SDL_AtomicGet(&ring_tail);
+    while (tail != (unsigned) SDL_AtomicGet(&ring_head)){
+        SDL_MemoryBarrierAcquire();
+        buzzer_edge *edge = &edge_ring[tail & (EDGE_RING_SIZE - 1)];
+
+        if (synced == 0){
+            offset = (int64_t) (position + latency) - (int64_t) edge->stamp;
+            synced = 1;
+        }
+        int64_t due = (int64_t) edge->stamp + offset;
+        if (due < (int64_t) position){
+            offset += (int64_t) position - due;
+            due = (int64_t) position;
+        }
+        else if (due > (int64_t) (position + MAX_AHEAD_SAMPLES)){
+            offset = (int64_t) (position + latency) - (int64_t) edge->stamp;
+            due = (int64_t) (position + latency);
+        }
+        if (due > (int64_t) position){
+            break;
+        }
+        if (edge->pitch != current.pitch || pattern_step == 0){
+            // 4000 * 2 ^ ((pitch - 64) / 48) bits per second
+            double rate = PATTERN_BASE_RATE * pow(2.0, (edge->pitch - 64) / 48.0);
+            pattern_step = (uint32_t) (rate * 65536.0 / SAMPLE_RATE);
+        }
+        current = *edge;
+        tail++;
+        SDL_AtomicSet(&ring_tail, (int) tail);
+    }
+}
+
+/**
+ * @brief Produce the next samples of the audio stream.
+ *
+ * @param samples Buffer to fill.
+ * @param count Number of samples to produce.
+ */
+void render_sound(int16_t* samples, int count){
+    follow_clock();
+    for (int k = 0; k < count; k++){
+        consume_edges();
+
+        // Short ramps so the tone never starts or stops on a step
+        if (current.on == 1 && envelope < RAMP_SAMPLES){
+            envelope++;
+        }
+        else if (current.on == 0 && envelope > 0){
+            envelope--;
+        }
+
+        int32_t square;
+        if (current.pattern_loaded){
+            // XO-CHIP pattern, one bit per step, most significant bit first
+            uint32_t bit = (pattern_phase >> 16) % PATTERN_BITS;
+            square = ((current.pattern[bit >> 3] >> (7 - (bit & 7))) & 1) ? TONE_AMPLITUDE : -TONE_AMPLITUDE;
+            pattern_phase += pattern_step;
+        }
+        else {
+            square = (phase < SAMPLE_RATE / 2) ? TONE_AMPLITUDE : -TONE_AMPLITUDE;
+            phase += TONE_FREQUENCY;
+            if (phase >= SAMPLE_RATE){
+                phase -= SAMPLE_RATE;
+            }
+        }
+        samples[k] = (int16_t) (square * (int32_t) envelope / RAMP_SAMPLES);
+        position++;
+    }
+}
+
+/**
+ * @brief Headless mode : append one emulated frame of audio to the WAV file.
+ *
+ */
+void write_wav_frame(){
+    int16_t samples[SAMPLES_PER_FRAME];
+
+    if (wav_file == NULL){
+        return;
+    }
+    render_sound(samples, SAMPLES_PER_FRAME);
+    for (int k = 0; k < SAMPLES_PER_FRAME; k++){
+        write_le((uint16_t) samples[k], 2);
+    }
+    wav_samples += SAMPLES_PER_FRAME;
+}
@@ -0,0 +1,290 @@
+/**
+ * @file telemetry.c
+ * @author Xavier Monard
+ * @brief Host performance telemetry of the main loop : histograms of the interpreter, present, sleep overshoot
+ * and frame times, achieved instruction and timer rates. The figures of the last interval are shown in an
+ * overlay (F3) and appended to a stats file.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include "include/telemetry.h"
+#include "include/cpu.h"
+
+static const char* metric_names[TELEMETRY_METRICS] = {"emulate", "present", "sleep", "frame"};
+static const char overlay_labels[TELEMETRY_METRICS] = {'E', 'D', '5', 'F'};
+
+static histogram interval[TELEMETRY_METRICS];
+static histogram run[TELEMETRY_METRICS];
+static FILE* stats_file = NULL;
+static double ns_per_tick = 0;
+static Uint64 start = 0;
+static Uint64 last_report = 0;
+static uint64_t frames = 0;
+static uint64_t instructions = 0;
+static uint64_t ticks = 0;
+static uint64_t total_frames = 0;
+static uint64_t total_instructions = 0;
+static uint8_t shown = 0;
+static char overlay_text[OVERLAY_LINES][32];
+static uint8_t font[16 * HEX_REP_SIZE];
+static framebuffer composite;
+
+/**
+ * @brief Add a value to a histogram.
+ *
+ * @param h The histogram.
+ * @param value The value, in ns.
+ */
+void histogram_record(histogram* h, uint64_t value){
+    uint32_t index;
+
+    if (value >= (1ULL << HISTOGRAM_MAX_BITS)){
+        value = (1ULL << HISTOGRAM_MAX_BITS) - 1;
+    }
+    if (value < 2 * HISTOGRAM_SUB){
+        index = (uint32_t) value;
+    }
+    else {
+        uint8_t shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+        index = (shift + 1) * HISTOGRAM_SUB + (uint32_t) ((value >> shift) - HISTOGRAM_SUB);
+    }
+    h->counts[index]++;
+    h->total++;
+    if (value > h->max){
+        h->max = value;
+    }
+}
+
+/**
+ * @brief Value below which a fraction of the values of a histogram fall.
+ *
+ * @param h The histogram.
+ * @param fraction 0.5 for the median, 0.999 for the 99.9th percentile.
+ * @return uint64_t The middle of the bucket of the percentile, in ns, 0 for an empty histogram.
+ */
+uint64_t histogram_percentile(histogram* h, double fraction){
+    uint64_t rank = (uint64_t) (fraction * h->total + 0.999999);
+    uint64_t seen = 0;
+
+    if (h->total == 0){
+        return 0;
+    }
+    rank = rank == 0 ? 1 : rank;
+    for (uint32_t index = 0; index < HISTOGRAM_BUCKETS; index++){
+        seen += h->counts[index];
+        if (seen < rank){
+            continue;
+        }
+        if (index < 2 * HISTOGRAM_SUB){
+            return index;
+        }
+        uint8_t shift = index / HISTOGRAM_SUB - 1;
+        uint64_t value = ((uint64_t) (HISTOGRAM_SUB + index % HISTOGRAM_SUB) << shift) + ((1ULL << shift) >> 1);
+        return value < h->max ? value : h->max;
+    }
+    return h->max;
+}
+
+/**
+ * @brief Add the values of a histogram to another one.
+ *
+ * @param to The receiving histogram.
+ * @param from The added histogram.
+ */
+void histogram_merge(histogram* to, histogram* from){
+    for (uint32_t index = 0; index < HISTOGRAM_BUCKETS; index++){
+        to->counts[index] += from->counts[index];
+    }
+    to->total += from->total;
+    to->max = from->max > to->max ? from->max : to->max;
+}
+
+/* Clamp a duration in ns to the microseconds the overlay can show. */
+static unsigned overlay_us(uint64_t ns){
+    uint64_t us = (ns + 500) / 1000;
+    return us > 99999 ? 99999 : (unsigned) us;
+}
+
+/* Append the figures of the interval to the stats file and the overlay, then start a new interval. */
+static void report(Uint64 now){
+    double seconds = (now - last_report) * ns_per_tick / 1e9;
+    double rate = instructions / seconds;
+    double timer = ticks / seconds;
+
+    for (uint8_t m = 0; m < TELEMETRY_METRICS; m++){
+        histogram* h = &interval[m];
+        snprintf(overlay_text[m], sizeof(overlay_text[m]), "%c%6u%6u%6u", overlay_labels[m], overlay_us(histogram_percentile(h, 0.5)),
+                 overlay_us(histogram_percentile(h, 0.99)), overlay_us(histogram_percentile(h, 0.999)));
+    }
+    snprintf(overlay_text[TELEMETRY_METRICS], sizeof(overlay_text[TELEMETRY_METRICS]), "C%8lu%4u",
+             rate < 99999999 ? (unsigned long) rate : 99999999UL, timer < 999 ? (unsigned) (timer + 0.5) : 999);
+
+    if (stats_file != NULL){
+        fprintf(stats_file, "%.3f %lu %.0f %.2f", (now - start) * ns_per_tick / 1e9, (unsigned long) frames, rate, timer);
+        for (uint8_t m = 0; m < TELEMETRY_METRICS; m++){
+            histogram* h = &interval[m];
+            fprintf(stats_file, " %.1f %.1f %.1f %.1f", histogram_percentile(h, 0.5) / 1e3, histogram_percentile(h, 0.99) / 1e3,
+                    histogram_percentile(h, 0.999) / 1e3, h->max / 1e3);
+        }
+        fputc('\n', stats_file);
+        fflush(stats_file);
+    }
+
+    for (uint8_t m = 0; m < TELEMETRY_METRICS; m++){
+        histogram_merge(&run[m], &interval[m]);
+        memset(&interval[m], 0, sizeof(histogram));
+    }
+    total_frames += frames;
+    total_instructions += instructions;
+    frames = 0;
+    instructions = 0;
+    ticks = 0;
+    last_report = now;
+}
+
+/**
+ * @brief Start measuring the main loop, after the machine was initialized.
+ *
+ * @param stats_path File receiving a line of figures per interval, NULL for none.
+ * @return uint8_t 1 on success, 0 otherwise.
+ */
+uint8_t telemetry_open(char* stats_path){
+    if (stats_path != NULL){
+        stats_file = fopen(stats_path, "w");
+        if (stats_file == NULL){
+            fprintf(stderr, "Unable to create the stats file %s\n", stats_path);
+            return 0;
+        }
+        fprintf(stats_file, "# seconds frames instructions_per_s timer_hz");
+        for (uint8_t m = 0; m < TELEMETRY_METRICS; m++){
+            fprintf(stats_file, " %s_p50_us %s_p99_us %s_p999_us %s_max_us", metric_names[m], metric_names[m], metric_names[m],
+                    metric_names[m]);
+        }
+        fputc('\n', stats_file);
+    }
+    // The overlay keeps its own digits, games may overwrite the ones in memory
+    memcpy(font, CPU.ram, sizeof(font));
+    ns_per_tick = 1e9 / SDL_GetPerformanceFrequency();
+    start = SDL_GetPerformanceCounter();
+    last_report = start;
+    for (uint8_t line = 0; line < OVERLAY_LINES; line++){
+        overlay_text[line][0] = '\0';
+    }
+    return 1;
+}
+
+/**
+ * @brief Record the duration of a part of the frame.
+ *
+ * @param metric TELEMETRY_EMULATE, TELEMETRY_PRESENT, TELEMETRY_SLEEP or TELEMETRY_FRAME.
+ * @param from Performance counter at the start of the part.
+ * @param to Performance counter at its end.
+ */
+void telemetry_record(uint8_t metric, Uint64 from, Uint64 to){
+    histogram_record(&interval[metric], to > from ? (uint64_t) ((to - from) * ns_per_tick) : 0);
+}
+
+/**
+ * @brief Count a frame, and report the interval when it is over.
+ *
+ * @param executed Instructions executed during the frame.
+ * @param counted Timer decrements done during the frame.
+ */
+void telemetry_frame(uint32_t executed, uint32_t counted){
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    frames++;
+    instructions += executed;
+    ticks += counted;
+    if ((now - last_report) * ns_per_tick >= TELEMETRY_INTERVAL * 1e6){
+        report(now);
+    }
+}
+
+/* Show or hide the overlay (F3). */
+void telemetry_toggle(){
+    shown = !shown;
+}
+
+/* Double the pixels of a 32 bits half row of the low resolution. */
+static uint64_t double_pixels(uint32_t half){
+    uint64_t wide = 0;
+
+    for (uint8_t b = 0; b < 32; b++){
+        if (half & (1u << b)){
+            wide |= 3ULL << (2 * b);
+        }
+    }
+    return wide;
+}
+
+/**
+ * @brief The framebuffer to present : the screen itself, or a copy in high resolution with the figures of the last
+ * interval over its top when the overlay is shown. A line per metric gives the p50, p99 and p999 in us of the
+ * emulation (E), the present (D), the sleep overshoot (5) and the frame (F), the last line gives the instructions
+ * per second and the timer rate in Hz (C).
+ *
+ * @param fb The screen.
+ * @return framebuffer* The framebuffer to render.
+ */
+framebuffer* telemetry_overlay(framebuffer* fb){
+    if (shown == 0){
+        return fb;
+    }
+
+    memcpy(composite.rows, fb->rows, sizeof(composite.rows));
+    if (fb->hires == 0){
+        for (uint8_t p = 0; p < PLANES; p++){
+            for (uint8_t y = 0; y < LORES_HEIGTH; y++){
+                uint64_t row = fb->rows[p][y][0];
+                uint64_t high = double_pixels(row >> 32);
+                uint64_t low = double_pixels((uint32_t) row);
+                composite.rows[p][2 * y][0] = composite.rows[p][2 * y + 1][0] = high;
+                composite.rows[p][2 * y][1] = composite.rows[p][2 * y + 1][1] = low;
+            }
+        }
+    }
+    composite.hires = 1;
+    composite.planes = 1;
+
+    // Dark band under the text, then the digits in the first plane
+    for (uint8_t p = 0; p < PLANES; p++){
+        memset(composite.rows[p], 0, OVERLAY_LINES * (HEX_REP_SIZE + 1) * sizeof(composite.rows[p][0]));
+    }
+    for (uint8_t line = 0; line < OVERLAY_LINES; line++){
+        for (uint8_t k = 0; overlay_text[line][k] != '\0'; k++){
+            char c = overlay_text[line][k];
+            uint8_t digit = c >= 'A' ? c - 'A' + 10 : c - '0';
+            if (c != ' '){
+                blit_sprite(&composite, &font[digit * HEX_REP_SIZE], 1 + 5 * k, 1 + (HEX_REP_SIZE + 1) * line, HEX_REP_SIZE, 0);
+            }
+        }
+    }
+    return &composite;
+}
+
+/* Report the last interval and print the figures of the whole run, when a stats file was given. */
+void telemetry_close(){
+    if (stats_file == NULL){
+        return;
+    }
+    Uint64 now = SDL_GetPerformanceCounter();
+    double seconds = (now - start) * ns_per_tick / 1e9;
+    report(now);
+    fclose(stats_file);
+    stats_file = NULL;
+
+    printf("Telemetry : %lu frames in %.2fs, %.0f instructions/s\n", (unsigned long) total_frames, seconds,
+           total_instructions / seconds);
+    for (uint8_t m = 0; m < TELEMETRY_METRICS; m++){
+        histogram* h = &run[m];
+        printf("  %-8s p50 %8.1f us  p99 %8.1f us  p999 %8.1f us  max %8.1f us\n", metric_names[m],
+               histogram_percentile(h, 0.5) / 1e3, histogram_percentile(h, 0.99) / 1e3, histogram_percentile(h, 0.999) / 1e3,
+               h->max / 1e3);
+    }
+}
@@ -0,0 +1,167 @@
+/**
+ * @file timing.c
+ * @author Xavier Monard
+ * @brief Optional cycle timing of the COSMAC VIP interpreter : each instruction is charged its cost in machine cycles
+ * and a frame runs instructions until its cycle budget is spent. The plain frame loop does not use this file.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "include/timing.h"
+
+/* Cycles spent in the current frame, the overdraft of an instruction is charged to the next frame. */
+static uint32_t used = 0;
+
+/**
+ * @brief Cycles of an instruction on the VIP, without the fetch, from the state before its execution.
+ * The costs follow the loops of the VIP interpreter : Dxyn shifts each sprite row by x % 8 bits,
+ * Fx33 subtracts powers of ten once per unit of each digit, Fx55 and Fx65 copy a register per pass.
+ * Instructions the VIP did not have are charged like their nearest VIP instruction.
+ *
+ * @param opcode The instruction.
+ * @return uint32_t Its cost in machine cycles.
+ */
+uint32_t instruction_cycles(uint16_t opcode){
+    uint8_t hexa[4];
+
+    hexa[0] = opcode >> 12;
+    hexa[1] = (opcode >> 8) & 0xF;
+    hexa[2] = (opcode >> 4) & 0xF;
+    hexa[3] = opcode & 0xF;
+
+    switch (hexa[0]){
+        case 0x00:
+            if (opcode == 0x00E0){
+                return 24 + 3078; // 256 bytes of display memory cleared
+            }
+            return 10; // 00EE and the SUPER-CHIP instructions
+
+        case 0x01: // 1nnn
+            return 12;
+
+        case 0x02: // 2nnn
+            return 26;
+
+        case 0x03: // 3xkk
+        case 0x04: // 4xkk
+            return 10;
+
+        case 0x05: // 5xy0
+        case 0x09: // 9xy0
+            return 14;
+
+        case 0x06: // 6xkk
+            return 6;
+
+        case 0x07: // 7xkk
+            return 10;
+
+        case 0x08: // 8xy0 to 8xyE, the arithmetic goes through a generated subroutine
+            return hexa[3] == 0x0 ? 12 : 44;
+
+        case 0x0A: // Annn
+            return 12;
+
+        case 0x0B: // Bnnn, 2 more cycles when the addition crosses a page
+            return ((opcode & 0xFF) + CPU.V[0] > 0xFF) ? 24 : 22;
+
+        case 0x0C: // Cxkk
+            return 36;
+
+        case 0x0D: { // Dxyn, each row is shifted in place then XORed on two bytes
+            uint8_t rows = hexa[3] == 0 ? 16 : hexa[3];
+            return 26 + rows * (46 + 8 * (CPU.V[hexa[1]] & 7));
+        }
+
+        case 0x0E: // Ex9E and ExA1
+            return 14;
+
+        case 0x0F:
+            switch (opcode & 0xFF){
+                case 0x07: // Fx07
+                case 0x15: // Fx15
+                case 0x18: // Fx18
+                case 0x0A: // Fx0A, charged per check while it waits
+                    return 10;
+
+                case 0x33: { // Fx33
+                    uint8_t value = CPU.V[hexa[1]];
+                    return 80 + 16 * (value / 100 + value / 10 % 10 + value % 10);
+                }
+
+                case 0x55: // Fx55
+                case 0x65: // Fx65
+                    return 14 + 14 * (hexa[1] + 1);
+
+                default: // Fx1E, Fx29 and the later instructions
+                    return 16;
+            }
+
+        default:
+            return 10;
+    }
+}
+
+/* 1 for the instructions skipping the next one when their condition holds. */
+static uint8_t is_skip(uint16_t opcode){
+    switch (opcode >> 12){
+        case 0x3: case 0x4: case 0x5: case 0x9:
+            return 1;
+        case 0xE:
+            return (opcode & 0xFF) == 0x9E || (opcode & 0xFF) == 0xA1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Execute the instruction at PC and charge its cycles to the frame. A draw in low resolution waits for
+ * the next display interrupt like on the VIP, so it ends the frame.
+ *
+ * @return uint8_t 0 to stop the emulator, 1 otherwise.
+ */
+uint8_t timed_step(){
+    uint16_t PC = CPU.PC;
+    uint16_t opcode = get_opcode();
+    uint32_t cost = TIMING_FETCH + instruction_cycles(opcode);
+    uint8_t keep_up = step();
+
+    if (is_skip(opcode) && CPU.PC != (uint16_t) (PC + 2)){
+        cost += TIMING_SKIP;
+    }
+    used += cost;
+    if ((opcode >> 12) == 0xD && CPU.screen.hires == 0 && used < TIMING_BUDGET){
+        used = TIMING_BUDGET;
+    }
+    return keep_up;
+}
+
+/**
+ * @brief Tell if the cycle budget of the frame is spent.
+ *
+ * @return uint8_t 1 when the frame must end.
+ */
+uint8_t timing_frame_done(){
+    return used >= TIMING_BUDGET;
+}
+
+/**
+ * @brief Cycles spent in the current frame, to stamp the buzzer edges.
+ *
+ * @return uint32_t The cycles, at most TIMING_BUDGET.
+ */
+uint32_t timing_cycles(){
+    return used < TIMING_BUDGET ? used : TIMING_BUDGET;
+}
+
+/* Start a new frame, the cycles spent past the budget are taken from it. */
+void timing_next_frame(){
+    used = used > TIMING_BUDGET ? used - TIMING_BUDGET : 0;
+}
+
+/* Forget the cycles of the previous ROM, its overdraft must not shorten the first frame of the next one. */
+void timing_reset(){
+    used = 0;
+}
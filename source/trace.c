@@ -0,0 +1,242 @@
+/**
+ * @file trace.c
+ * @author Xavier Monard
+ * @brief Opt-in execution trace. Every executed instruction is stored in a
+ * ring of chunks owned by the executing thread. Full chunks are compressed and
+ * written to disk by a writer thread. Linked in every binary, the emulator only
+ * records when cpu.c is built with -DTRACE.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "include/trace.h"
+#include "include/cpu.h"
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @brief Records of one thread. Chunks [flushed, published) wait for the writer,
+ * chunk current is being filled by the thread up to cursor.next. The writer posts freed after each chunk it wrote.
+ */
+typedef struct trace_ring {
+    trace_record chunks[TRACE_CHUNKS][TRACE_CHUNK_RECORDS];
+    uint32_t count[TRACE_CHUNKS];
+    SDL_atomic_t published;
+    SDL_atomic_t flushed;
+    uint32_t current;
+    trace_cursor cursor;
+    uint32_t thread;
+    SDL_sem* freed;
+    struct trace_ring* next;
+} trace_ring;
+
+/* A compressed record is never bigger than its mask and its 16 bytes */
+typedef char trace_record_size_check[(sizeof(trace_record) == 16) ? 1 : -1];
+
+uint8_t trace_enabled = 0;
+THREAD_LOCAL trace_cursor* trace_position = NULL;
+
+static THREAD_LOCAL trace_ring* ring = NULL;
+static trace_ring* rings = NULL;
+static uint32_t ring_count = 0;
+static SDL_mutex* rings_lock = NULL;
+static SDL_sem* work = NULL;
+static SDL_Thread* writer = NULL;
+static SDL_atomic_t running;
+static FILE* trace_file = NULL;
+static char crash_path[512];
+static uint8_t compressed[TRACE_COMPRESSED_CHUNK_SIZE];
+static uint8_t crash_compressed[TRACE_COMPRESSED_CHUNK_SIZE];
+
+/* Write the file header : magic, version and record size, with system calls only. */
+static void write_header(int fd){
+    uint16_t header[2] = {TRACE_VERSION, sizeof(trace_record)};
+    if (write(fd, TRACE_MAGIC, 4) != 4 || write(fd, header, sizeof(header)) != sizeof(header)){
+        return;
+    }
+}
+
+/* Compress one chunk of a ring in the trace file. */
+static void write_chunk(trace_ring* r, uint32_t chunk){
+    trace_block block;
+
+    block.thread = r->thread;
+    block.count = r->count[chunk];
+    block.size = trace_compress(r->chunks[chunk], block.count, compressed);
+    fwrite(&block, sizeof(block), 1, trace_file);
+    fwrite(compressed, block.size, 1, trace_file);
+    fflush(trace_file);
+}
+
+/* Write every published chunk of every thread. */
+static void flush_rings(){
+    SDL_LockMutex(rings_lock);
+    for (trace_ring* r = rings; r != NULL; r = r->next){
+        unsigned flushed = (unsigned) SDL_AtomicGet(&r->flushed);
+        while (flushed != (unsigned) SDL_AtomicGet(&r->published)){
+            SDL_MemoryBarrierAcquire();
+            write_chunk(r, flushed % TRACE_CHUNKS);
+            flushed++;
+            SDL_AtomicSet(&r->flushed, (int) flushed);
+            SDL_SemPost(r->freed);
+        }
+    }
+    SDL_UnlockMutex(rings_lock);
+}
+
+/* Writer thread, compresses the chunks as soon as they are published. */
+static int writer_main(void* data){
+    (void) data;
+    while (SDL_AtomicGet(&running)){
+        SDL_SemWaitTimeout(work, 100);
+        flush_rings();
+    }
+    flush_rings();
+    return 0;
+}
+
+/* Hand the current chunk to the writer and wait for a free one, records are never dropped. */
+static void publish_chunk(trace_ring* r){
+    r->count[r->current] = (uint32_t) (r->cursor.next - r->chunks[r->current]);
+    SDL_MemoryBarrierRelease();
+    unsigned published = (unsigned) SDL_AtomicGet(&r->published) + 1;
+    SDL_AtomicSet(&r->published, (int) published);
+    SDL_SemPost(work);
+
+    // Woken as soon as the writer frees a chunk, a sleep would leave a single core idle
+    while (published - (unsigned) SDL_AtomicGet(&r->flushed) >= TRACE_CHUNKS){
+        SDL_SemWait(r->freed);
+    }
+    r->current = published % TRACE_CHUNKS;
+    r->cursor.next = r->chunks[r->current];
+    r->cursor.end = r->cursor.next + TRACE_CHUNK_RECORDS;
+}
+
+/**
+ * @brief Fatal signal handler, the records not yet written by the crashing thread go to <trace>.crash.
+ *
+ * Only system calls are used here, the writer thread may own the trace file lock.
+ */
+static void crash_handler(int signal_number){
+    trace_ring* r = ring;
+
+    if (r != NULL){
+        int fd = open(crash_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0){
+            unsigned flushed = (unsigned) SDL_AtomicGet(&r->flushed);
+            unsigned published = (unsigned) SDL_AtomicGet(&r->published);
+            write_header(fd);
+            // The chunk being filled is the one following the published ones
+            r->count[r->current] = (uint32_t) (r->cursor.next - r->chunks[r->current]);
+            for (unsigned c = flushed; c != published + 1; c++){
+                uint32_t chunk = c % TRACE_CHUNKS;
+                trace_block block = {r->thread, r->count[chunk], 0};
+                block.size = trace_compress(r->chunks[chunk], block.count, crash_compressed);
+                if (write(fd, &block, sizeof(block)) != sizeof(block) || write(fd, crash_compressed, block.size) != (ssize_t) block.size){
+                    break;
+                }
+            }
+            close(fd);
+        }
+    }
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}
+
+/**
+ * @brief Start recording every executed instruction in a trace file.
+ *
+ * @param trace_path Path of the trace file to create.
+ * @return uint8_t 1 on success, 0 otherwise.
+ */
+uint8_t trace_open(char* trace_path){
+    trace_file = fopen(trace_path, "wb");
+    if (trace_file == NULL){
+        fprintf(stderr, "Unable to create the trace file %s\n", trace_path);
+        return 0;
+    }
+    uint16_t header[2] = {TRACE_VERSION, sizeof(trace_record)};
+    fwrite(TRACE_MAGIC, 4, 1, trace_file);
+    fwrite(header, sizeof(header), 1, trace_file);
+    snprintf(crash_path, sizeof(crash_path), "%s.crash", trace_path);
+
+    rings_lock = SDL_CreateMutex();
+    work = SDL_CreateSemaphore(0);
+    SDL_AtomicSet(&running, 1);
+    writer = SDL_CreateThread(writer_main, "trace writer", NULL);
+
+    int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+    for (uint8_t k = 0; k < sizeof(signals) / sizeof(signals[0]); k++){
+        signal(signals[k], crash_handler);
+    }
+    trace_enabled = 1;
+    return 1;
+}
+
+/**
+ * @brief Write the remaining records and close the trace file. The machine threads must be stopped.
+ *
+ */
+void trace_close(){
+    if (trace_enabled == 0){
+        return;
+    }
+    trace_enabled = 0;
+
+    SDL_LockMutex(rings_lock);
+    for (trace_ring* r = rings; r != NULL; r = r->next){
+        if (r->cursor.next != r->chunks[r->current]){
+            r->count[r->current] = (uint32_t) (r->cursor.next - r->chunks[r->current]);
+            SDL_MemoryBarrierRelease();
+            SDL_AtomicAdd(&r->published, 1);
+            r->cursor.next = r->chunks[r->current];
+        }
+    }
+    SDL_UnlockMutex(rings_lock);
+
+    SDL_AtomicSet(&running, 0);
+    SDL_SemPost(work);
+    SDL_WaitThread(writer, NULL);
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+/* Give a ring to the calling thread. */
+static trace_ring* register_ring(){
+    trace_ring* r = calloc(1, sizeof(trace_ring));
+    if (r == NULL){
+        fprintf(stderr, "Unable to allocate the trace ring.\n");
+        exit(EXIT_FAILURE);
+    }
+    r->freed = SDL_CreateSemaphore(0);
+    r->cursor.next = r->chunks[0];
+    r->cursor.end = r->cursor.next + TRACE_CHUNK_RECORDS;
+    SDL_LockMutex(rings_lock);
+    r->thread = ring_count++;
+    r->next = rings;
+    rings = r;
+    SDL_UnlockMutex(rings_lock);
+    return r;
+}
+
+/**
+ * @brief Give the calling thread a chunk to fill : its first one, or the next one once the current chunk is published.
+ *
+ * @return trace_cursor* The cursor of the thread, with room for at least one record.
+ */
+trace_cursor* trace_next_chunk(){
+    if (ring == NULL){
+        ring = register_ring();
+        trace_position = &ring->cursor;
+    }
+    else {
+        publish_chunk(ring);
+    }
+    return &ring->cursor;
+}
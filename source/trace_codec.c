@@ -0,0 +1,149 @@
+/**
+ * @file trace_codec.c
+ * @author Xavier Monard
+ * @brief Compression of the trace records, shared by the emulator and the trace tool.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "include/trace.h"
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifdef __AVX2__
+/* For each 8 bits mask, the indices of its set bytes packed first, the others are 0x80 so that the shuffle clears them. */
+static uint8_t pack_order[256][8];
+static uint8_t pack_ready = 0;
+
+static void build_pack_order(){
+    for (uint32_t mask = 0; mask < 256; mask++){
+        uint8_t packed = 0;
+        memset(pack_order[mask], 0x80, 8);
+        for (uint8_t b = 0; b < 8; b++){
+            if (mask & (1 << b)){
+                pack_order[mask][packed++] = b;
+            }
+        }
+    }
+    pack_ready = 1;
+}
+
+/**
+ * @brief Compress records, each one is XORed with the previous one and only its non zero bytes are kept.
+ * A record is handled in a 16 bytes register, each half packs its non zero bytes with one shuffle and is
+ * stored whole, the next bytes overwrite its tail.
+ *
+ * @param records Records to compress.
+ * @param count Number of records.
+ * @param out Output buffer of at least count * 18 bytes.
+ * @return uint32_t Size of the compressed data.
+ */
+uint32_t trace_compress(trace_record* records, uint32_t count, uint8_t* out){
+    __m128i previous = _mm_setzero_si128();
+    uint32_t size = 0;
+
+    if (pack_ready == 0){
+        build_pack_order();
+    }
+    for (uint32_t k = 0; k < count; k++){
+        __m128i words = _mm_loadu_si128((__m128i*) &records[k]);
+        __m128i delta = _mm_xor_si128(words, previous);
+        uint32_t mask = ~(uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(delta, _mm_setzero_si128())) & 0xFFFF;
+        uint64_t low_order, high_order;
+
+        memcpy(&low_order, pack_order[mask & 0xFF], 8);
+        memcpy(&high_order, pack_order[mask >> 8], 8);
+        // The high half takes its bytes from 8 to 15, 0x80 stays above 0x80
+        __m128i order = _mm_set_epi64x((long long) (high_order | 0x0808080808080808ULL), (long long) low_order);
+        __m128i packed = _mm_shuffle_epi8(delta, order);
+
+        out[size] = mask & 0xFF;
+        out[size + 1] = mask >> 8;
+        size += TRACE_MASK_SIZE;
+        _mm_storel_epi64((__m128i*) (out + size), packed);
+        size += __builtin_popcount(mask & 0xFF);
+        _mm_storel_epi64((__m128i*) (out + size), _mm_unpackhi_epi64(packed, packed));
+        size += __builtin_popcount(mask >> 8);
+        previous = words;
+    }
+    return size;
+}
+#else
+/**
+ * @brief Compress records, each one is XORed with the previous one and only its non zero bytes are kept.
+ * The XOR is done 8 bytes at a time, which assumes a little endian host.
+ *
+ * @param records Records to compress.
+ * @param count Number of records.
+ * @param out Output buffer of at least count * 18 bytes.
+ * @return uint32_t Size of the compressed data.
+ */
+uint32_t trace_compress(trace_record* records, uint32_t count, uint8_t* out){
+    uint64_t previous[2] = {0, 0};
+    uint32_t size = 0;
+
+    for (uint32_t k = 0; k < count; k++){
+        uint64_t words[2];
+        uint16_t mask = 0;
+        uint32_t mask_at = size;
+
+        memcpy(words, &records[k], sizeof(trace_record));
+        size += TRACE_MASK_SIZE;
+        for (uint8_t w = 0; w < 2; w++){
+            uint64_t delta = words[w] ^ previous[w];
+            // One bit per non zero byte, gathered from the low bit of each byte
+            uint64_t nonzero = delta | (delta >> 4);
+            nonzero |= nonzero >> 2;
+            nonzero |= nonzero >> 1;
+            nonzero &= 0x0101010101010101ULL;
+            uint32_t bits = (uint32_t) ((nonzero * 0x0102040810204080ULL) >> 56);
+            mask |= bits << (8 * w);
+            // Only the set bits are visited, a record changes about 5 of its 16 bytes
+            for (; bits != 0; bits &= bits - 1){
+                out[size++] = (uint8_t) (delta >> (8 * __builtin_ctz(bits)));
+            }
+        }
+        out[mask_at] = mask & 0xFF;
+        out[mask_at + 1] = mask >> 8;
+        previous[0] = words[0];
+        previous[1] = words[1];
+    }
+    return size;
+}
+#endif
+
+/**
+ * @brief Decompress records written by trace_compress, without reading past the end of the data.
+ *
+ * @param data Compressed data.
+ * @param size Size of the compressed data.
+ * @param count Number of records to decode.
+ * @param records Output records.
+ * @return uint32_t Number of records decoded, less than count if the data is truncated.
+ */
+uint32_t trace_decompress(uint8_t* data, uint32_t size, uint32_t count, trace_record* records){
+    uint8_t previous[sizeof(trace_record)] = {0};
+    uint32_t read = 0;
+
+    for (uint32_t k = 0; k < count; k++){
+        if (read + TRACE_MASK_SIZE > size){
+            return k;
+        }
+        uint16_t mask = data[read] | (data[read + 1] << 8);
+        read += TRACE_MASK_SIZE;
+        for (uint8_t b = 0; b < sizeof(trace_record); b++){
+            if (mask & (1 << b)){
+                if (read >= size){
+                    return k;
+                }
+                previous[b] ^= data[read++];
+            }
+        }
+        memcpy(&records[k], previous, sizeof(trace_record));
+    }
+    return count;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file tracer.c
+ * @author Xavier Monard
+ * @brief Post-mortem analysis of the execution traces recorded with --trace.
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/trace.h"
+#include "include/disassembler.h"
+
+/* Records of the trace, in execution order for each thread. */
+typedef struct {
+    trace_record record;
+    uint32_t thread;
+} traced;
+
+traced* records = NULL;
+uint32_t record_count = 0;
+uint32_t record_capacity = 0;
+
+/**
+ * @brief Append the records of a trace file, a missing file is ignored if optional.
+ *
+ * @param trace_path Path of the trace file.
+ * @param optional 1 if the file may not exist.
+ */
+void load_trace(char* trace_path, uint8_t optional){
+    FILE* file = fopen(trace_path, "rb");
+    char magic[4];
+    uint16_t header[2];
+    trace_block block;
+    uint8_t* data = malloc(TRACE_COMPRESSED_CHUNK_SIZE);
+    trace_record* chunk = malloc(TRACE_CHUNK_RECORDS * sizeof(trace_record));
+
+    if (file == NULL){
+        if (optional == 0){
+            fprintf(stderr, "Unable to open the trace file %s\n", trace_path);
+            exit(EXIT_FAILURE);
+        }
+        free(data);
+        free(chunk);
+        return;
+    }
+    if (fread(magic, 4, 1, file) != 1 || memcmp(magic, TRACE_MAGIC, 4) != 0
+        || fread(header, sizeof(header), 1, file) != 1 || header[1] != sizeof(trace_record)){
+        fprintf(stderr, "%s is not a trace file.\n", trace_path);
+        exit(EXIT_FAILURE);
+    }
+
+    while (fread(&block, sizeof(block), 1, file) == 1){
+        // A crash dump may end in a partly written block
+        if (block.count > TRACE_CHUNK_RECORDS || block.size > TRACE_COMPRESSED_CHUNK_SIZE || fread(data, block.size, 1, file) != 1
+            || trace_decompress(data, block.size, block.count, chunk) != block.count){
+            fprintf(stderr, "Truncated block in %s, the end of the trace is lost.\n", trace_path);
+            break;
+        }
+
+        if (record_count + block.count > record_capacity){
+            record_capacity = 2 * record_capacity + block.count;
+            records = realloc(records, record_capacity * sizeof(traced));
+        }
+        for (uint32_t k = 0; k < block.count; k++){
+            records[record_count].record = chunk[k];
+            records[record_count].thread = block.thread;
+            record_count++;
+        }
+    }
+    fclose(file);
+    free(data);
+    free(chunk);
+}
+
+/**
+ * @brief Print one record with the mnemonic of its instruction.
+ *
+ * @param index Index of the record in the trace.
+ */
+void print_record(uint32_t index){
+    trace_record* r = &records[index].record;
+    char text[MNEMONIC_SIZE];
+
+    if (r->opcode == 0xF000){
+        snprintf(text, sizeof(text), "LD I, LONG %d", r->next_I);
+    }
+    else {
+        disassemble(r->opcode, text, sizeof(text));
+    }
+    printf("%10u t%u %04X: %04X %-18s I=%04X->%04X Vx=%02X Vy=%02X VF=%02X DT=%02X ST=%02X SP=%X\n",
+           index, records[index].thread, r->PC, r->opcode, text, r->I, r->next_I,
+           r->vx, r->vy, r->vf, r->delay, r->sound_timer, r->stack_pointer);
+}
+
+/**
+ * @brief Memory range written by an instruction (Fx33, Fx55 and 5xy2).
+ *
+ * @param r The record of the instruction.
+ * @param first First written address.
+ * @param last Last written address.
+ * @return uint8_t 1 if the instruction writes memory.
+ */
+uint8_t written_range(trace_record* r, uint32_t* first, uint32_t* last){
+    uint8_t x = (r->opcode >> 8) & 0xF;
+    uint8_t y = (r->opcode >> 4) & 0xF;
+
+    if ((r->opcode & 0xF0FF) == 0xF033){
+        *first = r->I;
+        *last = r->I + 2;
+        return 1;
+    }
+    if ((r->opcode & 0xF0FF) == 0xF055){
+        *first = r->I;
+        *last = r->I + x;
+        return 1;
+    }
+    if ((r->opcode & 0xF00F) == 0x5002){
+        *first = r->I;
+        *last = r->I + (x > y ? x - y : y - x);
+        return 1;
+    }
+    return 0;
+}
+
+/* Instructions loading I : Annn, F000 nnnn, Fx1E, Fx29 and Fx30. */
+uint8_t sets_I(trace_record* r){
+    return (r->opcode & 0xF000) == 0xA000 || r->opcode == 0xF000
+        || (r->opcode & 0xF0FF) == 0xF01E || (r->opcode & 0xF0FF) == 0xF029
+        || (r->opcode & 0xF0FF) == 0xF030;
+}
+
+int main(int argc, char* argv[]){
+    if (argc < 2){
+        printf("You must give a trace file.\n");
+        printf("Usage : %s <trace> [--last <n>] [--writes <address>] [--who-set-i [<index>]]\n", argv[0]);
+        return 1;
+    }
+
+    // Records the emulator could not write before crashing
+    char crash_path[512];
+    snprintf(crash_path, sizeof(crash_path), "%s.crash", argv[1]);
+    load_trace(argv[1], 0);
+    load_trace(crash_path, 1);
+
+    if (argc >= 4 && strcmp(argv[2], "--last") == 0){
+        // Last instructions before the end of the trace (or the crash)
+        uint32_t n = strtoul(argv[3], NULL, 0);
+        uint32_t first = n < record_count ? record_count - n : 0;
+        for (uint32_t k = first; k < record_count; k++){
+            print_record(k);
+        }
+    }
+    else if (argc >= 4 && strcmp(argv[2], "--writes") == 0){
+        // Every instruction storing in the address
+        uint32_t address = strtoul(argv[3], NULL, 0);
+        for (uint32_t k = 0; k < record_count; k++){
+            uint32_t first, last;
+            if (written_range(&records[k].record, &first, &last) && first <= address && address <= last){
+                print_record(k);
+            }
+        }
+    }
+    else if (argc >= 3 && strcmp(argv[2], "--who-set-i") == 0){
+        // Every instruction loading I, or only the last one before a record
+        if (argc >= 4 && record_count > 0){
+            // I as seen by the record index was loaded by an earlier instruction of the same thread
+            uint32_t index = strtoul(argv[3], NULL, 0);
+            if (index >= record_count){
+                index = record_count - 1;
+            }
+            for (uint32_t k = index; k-- > 0;){
+                if (sets_I(&records[k].record) && records[k].thread == records[index].thread){
+                    print_record(k);
+                    break;
+                }
+            }
+        }
+        else {
+            for (uint32_t k = 0; k < record_count; k++){
+                if (sets_I(&records[k].record)){
+                    print_record(k);
+                }
+            }
+        }
+    }
+    else {
+        for (uint32_t k = 0; k < record_count; k++){
+            print_record(k);
+        }
+    }
+    free(records);
+    return 0;
+}
@@ -26,180 +26,10 @@ void load_rom(char* rom_name){
     fclose(rom);
 }
 
-void translate_opcode(int* hexa){
-
-    switch(hexa[0]){
-        case 0x0:
-            if (hexa[2] == 0xE && hexa[3] == 0x0){
-                printf("CLS");
-            } else if (hexa[2] == 0xE && hexa[3] == 0xE){
-                printf("RET");
-            } else {
-                printf("SYS %X", (hexa[1]<<8)+(hexa[2]<<4)+hexa[3]);
-            }
-            break;
-
-        case 0x1:
-            printf("JP %d", (hexa[1]<<8)+(hexa[2]<<4)+hexa[3]);
-            break;
-
-        case 0x2:
-            printf("CALL %d",(hexa[1]<<8)+(hexa[2]<<4)+hexa[3]);
-            break;
-
-        case 0x3:
-            printf("SE V%X, %d",hexa[1],((hexa[2]<<4)+hexa[3]));
-            break;
-
-        case 0x4:
-            printf("SNE V%X, %d",hexa[1],((hexa[2]<<4)+hexa[3]));
-            break;
-
-        case 0x5:
-            printf("SE V%X,V%X",hexa[1],hexa[2]);
-            break;
-
-        case 0x6:
-            printf("LD V%X, %d", hexa[1], ((hexa[2]<<4)+hexa[3]));
-            break;
-            
-        case 0x7:
-            printf("ADD V%X, V%X",hexa[1],hexa[2]);
-            break;
-
-        case 0x8:
-            switch(hexa[3]){
-                case 0x0:
-                    printf("LD V%X, V%X", hexa[1], hexa[2]);
-                    break;
-
-                case 0x1:
-                    printf("OR V%X, V%X", hexa[1], hexa[2]);
-                    break;
-
-                case 0x2:
-                    printf("AND V%X, V%X", hexa[1], hexa[2]);
-                    break;
-
-                case 0x3:
-                    printf("XOR V%X, V%X", hexa[1], hexa[2]);
-                    break;
-
-                case 0x4:
-                    printf("ADD V%X, V%X", hexa[1], hexa[2]);
-                    break;
-
-                case 0x5:
-                    printf("SUB V%X, V%X", hexa[1], hexa[2]);
-                    break;
-
-                case 0x6:
-                    printf("SHR V%X {, V%X}", hexa[1], hexa[2]);
-                    break;
-
-                case 0x7:
-                    printf("SUBN V%X, V%X", hexa[1], hexa[2]);
-                    break;
-
-                case 0xE:
-                    printf("SHL V%X {, V%X}", hexa[1], hexa[2]);
-                    break;
-
-                default:
-                    break;
-            }
-            break;
-            
-        case 0x9:
-            printf("SNE V%X, V%X",hexa[1],hexa[2]);
-            break;
-
-        case 0xA:
-            printf("LD I, %d", ((hexa[1]<<8)+(hexa[2]<<4)+hexa[3]));
-            break;
-
-        case 0xB:
-            printf("JP V0, %d",((hexa[1]<<8)+(hexa[2]<<4)+hexa[3]));
-            break;
-
-        case 0xC:
-            printf("RND V%X, %X",hexa[1], ((hexa[2]<<4)+hexa[3]));
-            break;
-
-        case 0xD:
-            printf("DRW V%X, V%X, %d",hexa[1],hexa[2],hexa[3]);
-            break;
-
-        case 0xE:
-            switch(hexa[3]){
-                case 0xE:
-                    printf("SKP V%X",hexa[1]);
-                    break;
-
-                case 0x1:
-                    printf("SKNP V%X",hexa[1]);
-                    break;
-
-                default:
-                    break;
-            }
-            break;
-
-        case 0xF:{
-            switch(hexa[3]){
-                case 0x7:
-                    printf("LD V%X, DT",hexa[1]);
-                    break;
-
-                case 0xA:
-                    printf("LD V%X, K",hexa[1]);
-                    break;
-
-                case 0x5:
-                    switch(hexa[2]){
-                        case 0x1:
-                            printf("LD DT, V%X",hexa[1]);
-                            break;
-
-                        case 0x5:
-                            printf("LD [I], V%X", hexa[1]);
-                            break;
-
-                        case 0x6:
-                            printf("LD V%X, [I]", hexa[1]);
-                            break;
-
-                        default:
-                            break;
-                    }
-                    break;
-
-                case 0x8:
-                    printf("LD ST, V%X",hexa[1]);
-                    break;
-
-                case 0xE:
-                    printf("ADD I, V%X", hexa[1]);
-                    break;
-
-                case 0x9:
-                    printf("LD F, V%X", hexa[1]);
-                    break;
-
-                case 0x3:
-                    printf("LD B, V%X", hexa[1]);
-                    break;
-            }
-        }
-
-        default:
-            break;
-    }
-}
-
 void hex2asm(){
     int mask[4] = {0xF000, 0x0F00, 0x00F0, 0x000F};
     int hexa[4];
+    char text[MNEMONIC_SIZE];
 
     for (uint16_t k = 0; k < ROM_SIZE-1; k+=2){
         uint16_t command = (rom_code[k]<<8) + rom_code[k+1];
@@ -209,8 +39,14 @@ void hex2asm(){
         }
         // call the translation function
         printf("%d.", k+READ_AREA);
-        translate_opcode(hexa);
-        printf("\n");
+        if (command == 0xF000 && k+3 < ROM_SIZE){
+            // XO-CHIP long load, the address is the next 2 bytes
+            printf("LD I, LONG %d\n", (rom_code[k+2]<<8) + rom_code[k+3]);
+            k+=2;
+            continue;
+        }
+        translate_opcode(hexa, text, sizeof(text));
+        printf("%s\n", text);
     }
 }
 